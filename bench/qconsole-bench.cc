@@ -0,0 +1,468 @@
+// Copyright (c) 2021 Leonardo da Vinci
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// qconsole-bench runs parameterized workloads over the interactive pipeline and prints the
+// results as JSON, to be compared between releases. Every workload is repeated and its median
+// run is reported.
+
+#include <QConsole>
+#include <QtCore/QBuffer>
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QRegularExpression>
+#include <QtCore/QTemporaryDir>
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+// The prefixes of the generated command names, so that completion has shared prefixes to narrow.
+static const char* const TOPICS[] = { "config", "connect", "debug", "deploy", "git",  "graph", "log",   "net",
+                                      "plugin", "print",   "queue", "reload", "scan", "set",   "status", "user" };
+
+// The number of names typed one keystroke at a time for the completion and hint latencies.
+static constexpr int TYPED_NAMES = 64;
+
+// The number of commands invoked by name for the lookup workloads.
+static constexpr int LOOKUPS = 10000;
+
+// Return the name of the i-th generated command.
+static QString commandName(int i)
+{
+    return QString::fromLatin1(TOPICS[i % std::size(TOPICS)]) % QLatin1Char('-') % QString::number(i);
+}
+
+// Return the generated commands, which do nothing.
+static QList<QConsole::Command> makeCommands(int count)
+{
+    QList<QConsole::Command> commands;
+    commands.reserve(count);
+
+    for (int i = 0; i < count; ++i) {
+        commands.append({
+          commandName(i),
+          "Generated command, which does nothing but has a description of typical length.",
+          [](const QConsole::Context& ctx) { Q_UNUSED(ctx) },
+        });
+    }
+
+    return commands;
+}
+
+// Run the function and return how long it took, in nanoseconds.
+template <typename F>
+static qint64 timed(F&& f)
+{
+    QElapsedTimer timer;
+    timer.start();
+    f();
+    return timer.nsecsElapsed();
+}
+
+// Bench collects the results of the workloads matching the filter.
+class Bench
+{
+public:
+    Bench(const QRegularExpression& filter, int repeat)
+      : m_filter(filter)
+      , m_repeat(std::max(repeat, 1))
+    {}
+
+    // Check if the workload should be run.
+    bool enabled(const QString& workload) const
+    {
+        return m_filter.match(workload).hasMatch();
+    }
+
+    // Run the workload, which times itself, and report the median of its runs. The operations
+    // are the units the time is divided by, like the commands added or the lines rendered.
+    QJsonObject& measure(const QString& workload, const QJsonObject& parameters, qint64 operations,
+                         const std::function<qint64()>& run)
+    {
+        std::vector<qint64> runs;
+
+        for (int i = 0; i < m_repeat; ++i) {
+            runs.push_back(run());
+        }
+
+        std::sort(runs.begin(), runs.end());
+
+        const auto median = runs[runs.size() / 2];
+
+        QJsonObject result{
+            { "workload", workload },
+            { "parameters", parameters },
+            { "repeat", m_repeat },
+            { "operations", operations },
+            { "median_ns", median },
+            { "min_ns", runs.front() },
+            { "max_ns", runs.back() },
+            { "ns_per_operation", static_cast<double>(median) / static_cast<double>(std::max<qint64>(operations, 1)) },
+        };
+
+        return add(std::move(result));
+    }
+
+    // Report the latencies of individual operations, like keystrokes, with their percentiles.
+    QJsonObject& latencies(const QString& workload, const QJsonObject& parameters, std::vector<qint64>& samples)
+    {
+        std::sort(samples.begin(), samples.end());
+
+        const auto percentile = [&samples](double p) {
+            return samples.empty() ? 0 : samples[static_cast<size_t>(p * static_cast<double>(samples.size() - 1))];
+        };
+
+        qint64 total = 0;
+
+        for (const auto sample : samples) {
+            total += sample;
+        }
+
+        QJsonObject result{
+            { "workload", workload },
+            { "parameters", parameters },
+            { "operations", static_cast<qint64>(samples.size()) },
+            { "mean_ns", samples.empty() ? 0 : total / static_cast<qint64>(samples.size()) },
+            { "p50_ns", percentile(0.5) },
+            { "p90_ns", percentile(0.9) },
+            { "p99_ns", percentile(0.99) },
+            { "max_ns", samples.empty() ? 0 : samples.back() },
+        };
+
+        return add(std::move(result));
+    }
+
+    // Return the document holding every result.
+    QJsonDocument document() const
+    {
+        QJsonArray results;
+
+        for (const auto& result : m_results) {
+            results.append(result);
+        }
+
+        return QJsonDocument(QJsonObject{
+          { "version", QStringLiteral(QCONSOLE_VERSION) },
+          { "qt", QString::fromLatin1(qVersion()) },
+          { "date", QDateTime::currentDateTimeUtc().toString(Qt::ISODate) },
+          { "results", results },
+        });
+    }
+
+private:
+    QJsonObject& add(QJsonObject&& result)
+    {
+        const auto parameters = QJsonDocument(result.value("parameters").toObject()).toJson(QJsonDocument::Compact);
+
+        std::fprintf(stderr, "%-28s %-24s %s\n", qPrintable(result.value("workload").toString()),
+                     parameters.constData(),
+                     result.contains("ns_per_operation")
+                       ? qPrintable(QString::number(result.value("ns_per_operation").toDouble(), 'f', 1) % " ns/op")
+                       : qPrintable(QString::number(result.value("p99_ns").toInteger()) % " ns p99"));
+
+        m_results.push_back(std::move(result));
+        return m_results.back();
+    }
+
+    QRegularExpression       m_filter;
+    int                      m_repeat;
+    std::vector<QJsonObject> m_results;
+};
+
+// Registry workloads: adding the commands, finding them by name before and after sealing,
+// completing and hinting their names one keystroke at a time, and rendering "help".
+static void registryWorkloads(Bench& bench, int size)
+{
+    const QJsonObject parameters{ { "commands", size } };
+
+    if (bench.enabled("registry.populate")) {
+        bench.measure("registry.populate", parameters, size, [size]() {
+            QConsole console;
+            auto     commands = makeCommands(size);
+
+            return timed([&]() { console.addCommands(std::move(commands)); });
+        });
+    }
+
+    QConsole console;
+    QBuffer  buffer;
+
+    buffer.open(QBuffer::WriteOnly);
+    console.setOutputDevice(&buffer);
+    console.addDefaultCommands();
+    console.addCommands(makeCommands(size));
+
+    QList<QString> names;
+
+    for (int i = 0; i < LOOKUPS; ++i) {
+        names.append(commandName(static_cast<int>((static_cast<qint64>(i) * 7919) % size)));
+    }
+
+    const auto lookup = [&]() {
+        return timed([&]() {
+            for (const auto& name : names) {
+                console.invokeCommandByName(name);
+            }
+        });
+    };
+
+    if (bench.enabled("registry.lookup")) {
+        bench.measure("registry.lookup", parameters, LOOKUPS, lookup);
+    }
+
+    // Typing a name goes through every prefix of it, the last keystroke completes the name.
+    std::vector<QString> typed;
+
+    for (int i = 0; i < TYPED_NAMES; ++i) {
+        typed.push_back(commandName(static_cast<int>((static_cast<qint64>(i) * 104729) % size)));
+    }
+
+    if (bench.enabled("keystroke.complete")) {
+        std::vector<qint64> samples;
+
+        for (const auto& name : typed) {
+            for (qsizetype length = 1; length <= name.size(); ++length) {
+                const auto prefix = name.left(length);
+                samples.push_back(timed([&]() { console.completions(prefix); }));
+            }
+        }
+
+        bench.latencies("keystroke.complete", parameters, samples);
+    }
+
+    if (bench.enabled("keystroke.hint")) {
+        std::vector<qint64> samples;
+
+        for (const auto& name : typed) {
+            for (qsizetype length = 1; length <= name.size(); ++length) {
+                const auto prefix = name.left(length);
+                samples.push_back(timed([&]() { console.hint(prefix); }));
+            }
+        }
+
+        bench.latencies("keystroke.hint", parameters, samples);
+    }
+
+    if (bench.enabled("help.render")) {
+        qint64 lines = 0;
+        qint64 bytes = 0;
+
+        auto& result = bench.measure("help.render", parameters, size, [&]() {
+            buffer.buffer().clear();
+            buffer.seek(0);
+
+            const auto elapsed = timed([&]() {
+                console.evaluate("help");
+                console.flushOutput();
+            });
+
+            lines = buffer.data().count('\n');
+            bytes = buffer.size();
+            return elapsed;
+        });
+
+        const auto seconds = result.value("median_ns").toDouble() / 1e9;
+
+        result.insert("lines", lines);
+        result.insert("bytes", bytes);
+        result.insert("lines_per_second", seconds > 0 ? static_cast<double>(lines) / seconds : 0.0);
+        result.insert("bytes_per_second", seconds > 0 ? static_cast<double>(bytes) / seconds : 0.0);
+    }
+
+    if (bench.enabled("registry.lookup_sealed")) {
+        console.seal();
+        bench.measure("registry.lookup_sealed", parameters, LOOKUPS, lookup);
+    }
+}
+
+// Tokenization workload: evaluating a line with a long list of arguments, a third of them quoted.
+static void tokenizeWorkload(Bench& bench, int arguments)
+{
+    if (!bench.enabled("evaluate.tokenize")) {
+        return;
+    }
+
+    QConsole console;
+    QBuffer  buffer;
+
+    buffer.open(QBuffer::WriteOnly);
+    console.setOutputDevice(&buffer);
+    console.addCommand({ "noop", "Do nothing.", [](const QConsole::Context& ctx) { Q_UNUSED(ctx) } });
+
+    QString line = QStringLiteral("noop");
+
+    for (int i = 0; i < arguments; ++i) {
+        line += i % 3 == 0 ? QStringLiteral(" 'quoted argument %1'").arg(i) : QStringLiteral(" argument-%1").arg(i);
+    }
+
+    // Short lines are evaluated many times so that a run lasts long enough to be timed.
+    const auto evaluations = std::max(1, 100000 / arguments);
+
+    bench.measure("evaluate.tokenize", QJsonObject{ { "arguments", arguments } },
+                  static_cast<qint64>(evaluations) * arguments, [&]() {
+                      return timed([&]() {
+                          for (int i = 0; i < evaluations; ++i) {
+                              console.evaluate(line);
+                          }
+                      });
+                  });
+}
+
+// History workloads: loading a history file, searching it, and appending lines to it.
+static void historyWorkloads(Bench& bench, int entries)
+{
+    const QJsonObject parameters{ { "entries", entries } };
+
+    QTemporaryDir dir;
+
+    if (!dir.isValid()) {
+        std::fprintf(stderr, "qconsole-bench: can't create a temporary directory\n");
+        return;
+    }
+
+    const auto path = dir.filePath("history");
+
+    {
+        QFile file(path);
+        file.open(QIODevice::WriteOnly);
+
+        for (int i = 0; i < entries; ++i) {
+            file.write(QByteArray(commandName(i).toUtf8() + " --verbose " + QByteArray::number(i % 97) + '\n'));
+        }
+    }
+
+    if (bench.enabled("history.load")) {
+        bench.measure("history.load", parameters, entries, [&]() {
+            QConsole console;
+            return timed([&]() { console.setHistoryFilePath(path); });
+        });
+    }
+
+    if (bench.enabled("history.search")) {
+        QConsole console;
+        console.setHistoryFilePath(path);
+
+        std::vector<qint64> samples;
+
+        for (const auto topic : TOPICS) {
+            const auto pattern = QString::fromLatin1(topic) % QStringLiteral("-1");
+            samples.push_back(timed([&]() { console.searchHistory(pattern, 100); }));
+        }
+
+        bench.latencies("history.search", parameters, samples);
+    }
+
+    if (bench.enabled("history.save")) {
+        int run = 0;
+
+        bench.measure("history.save", parameters, entries, [&]() {
+            QConsole console;
+            console.setHistoryFilePath(dir.filePath("saved-" % QString::number(run++)));
+
+            return timed([&]() {
+                for (int i = 0; i < entries; ++i) {
+                    console.addHistory(commandName(i) % QStringLiteral(" --verbose"));
+                }
+            });
+        });
+    }
+}
+
+// Parse a comma-separated list of positive integers.
+static std::vector<int> parseSizes(const QString& list)
+{
+    std::vector<int> sizes;
+
+    for (const auto& item : list.split(QLatin1Char(','), Qt::SkipEmptyParts)) {
+        if (const auto size = item.trimmed().toInt(); size > 0) {
+            sizes.push_back(size);
+        }
+    }
+
+    return sizes;
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("qconsole-bench");
+    app.setApplicationVersion(QCONSOLE_VERSION);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Run the QConsole benchmarks and print the results as JSON.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addOptions({
+      { "commands", "Registry sizes, comma-separated.", "sizes", "1000,10000,100000,1000000" },
+      { "arguments", "Argument counts of the tokenized lines, comma-separated.", "counts", "10,100,1000,10000" },
+      { "history", "History sizes, comma-separated.", "sizes", "10000,100000" },
+      { "filter", "Only run the workloads matching the regular expression.", "pattern", "." },
+      { "repeat", "Number of runs of each workload, the median is reported.", "count", "5" },
+      { "output", "Write the results to a file instead of stdout.", "path" },
+    });
+    parser.process(app);
+
+    const QRegularExpression filter(parser.value("filter"));
+
+    if (!filter.isValid()) {
+        std::fprintf(stderr, "qconsole-bench: invalid filter: %s\n", qPrintable(filter.errorString()));
+        return 2;
+    }
+
+    Bench bench(filter, parser.value("repeat").toInt());
+
+    for (const auto size : parseSizes(parser.value("commands"))) {
+        registryWorkloads(bench, size);
+    }
+
+    for (const auto count : parseSizes(parser.value("arguments"))) {
+        tokenizeWorkload(bench, count);
+    }
+
+    for (const auto size : parseSizes(parser.value("history"))) {
+        historyWorkloads(bench, size);
+    }
+
+    const auto json = bench.document().toJson();
+
+    if (parser.isSet("output")) {
+        QFile file(parser.value("output"));
+
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size()) {
+            std::fprintf(stderr, "qconsole-bench: can't write %s\n", qPrintable(parser.value("output")));
+            return 1;
+        }
+    } else {
+        std::fwrite(json.constData(), 1, static_cast<size_t>(json.size()), stdout);
+    }
+
+    return 0;
+}
@@ -26,7 +26,9 @@
 #include <QtCore/QDir>
 #include <QtCore/QLoggingCategory>
 #include <QtCore/QProcess>
+#include <QtCore/QPromise>
 #include <QtCore/QStandardPaths>
+#include <QtCore/QThread>
 #include <QtNetwork/QNetworkAccessManager>
 #include <QtNetwork/QNetworkReply>
 #include <QtNetwork/QNetworkRequest>
@@ -81,57 +83,70 @@ int main(int argc, char** argv)
     static QConsole c;
     c.addDefaultCommands();
 
+    // The handler can be called from any thread, "print" queues the messages without locking
+    // and writes them above the prompt.
     qInstallMessageHandler([](QtMsgType type, const QMessageLogContext& context, const QString& message) {
         Q_UNUSED(context);
 
         switch (type) {
         case QtInfoMsg:
         case QtDebugMsg:
-            c.ostream() << message << Qt::endl;
+            c.print(message);
             break;
         case QtCriticalMsg:
-            c.ostream() << QConsole::colorize(QStringLiteral("Error: ").append(message), QConsole::Color::Red,
-                                              QConsole::Style::Normal)
-                        << Qt::endl;
+            c.print(QConsole::colorize(QStringLiteral("Error: ").append(message), QConsole::Color::Red,
+                                       QConsole::Style::Normal));
             break;
         case QtWarningMsg:
-            c.ostream() << QConsole::colorize(QStringLiteral("Warning: ").append(message), QConsole::Color::Red,
-                                              QConsole::Style::Normal)
-                        << Qt::endl;
+            c.print(QConsole::colorize(QStringLiteral("Warning: ").append(message), QConsole::Color::Red,
+                                       QConsole::Style::Normal));
             break;
         case QtFatalMsg:
-            c.ostream() << QConsole::colorize(QStringLiteral("Fatal: ").append(message), QConsole::Color::Red,
-                                              QConsole::Style::Normal)
-                        << Qt::endl;
+            // The application is about to abort, so there's no time to wait for the console.
+            fprintf(stderr, "Fatal: %s\n", qPrintable(message));
         }
     });
 
     c.setHistoryFilePath(history);
     c.setDefaultPrompt(QStringLiteral("[?][%1]: ").arg(QConsole::colorize("#", QConsole::Color::Red)));
 
+    QNetworkAccessManager nm;
+
     c.addCommand({
       "http-get",
-      "Send an http request to showcase QEventLoop capabilities.",
+      "Send an http request without blocking the prompt.",
+      nullptr,
       [&](const QConsole::Context& ctx) {
-          QNetworkAccessManager nm;
+          auto promise = std::make_shared<QPromise<void>>();
+          promise->start();
 
-          QNetworkRequest request(ctx.arguments.join(" "));
-          QNetworkReply*  reply = nm.get(request);
+          QNetworkReply* reply = nm.get(QNetworkRequest(ctx.arguments.join(" ")));
 
-          QEventLoop loop;
-          QObject::connect(reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
-          loop.exec();
+          QObject::connect(reply, &QNetworkReply::finished, [reply, promise]() {
+              if (reply->error() == QNetworkReply::NoError) {
+                  c.print(reply->readAll());
+              } else {
+                  qWarning() << reply->errorString();
+              }
 
-          if (reply->error() == QNetworkReply::NoError) {
-              c.ostream() << reply->readAll() << Qt::endl;
-          } else {
-              qWarning() << reply->errorString();
-          }
+              reply->deleteLater();
+              promise->finish();
+          });
 
-          reply->deleteLater();
+          return promise->future();
       },
     });
 
+    c.addCommand({
+      "sleep",
+      "Sleep on a worker thread for the given number of seconds.",
+      nullptr,
+      QConsole::runInThreadPool([&](const QConsole::Context& ctx) {
+          QThread::sleep(ctx.arguments.value(0, "1").toULong());
+          c.print(QStringLiteral("Slept for %1 second(s).").arg(ctx.arguments.value(0, "1")));
+      }),
+    });
+
     c.addCommand({
       "shell",
       "Add executable programs found under $PATH as commands.",
@@ -182,74 +197,79 @@ int main(int argc, char** argv)
       },
     });
 
+    // The online commands live in their own scope, which is activated when connecting to the
+    // server and deactivated when disconnecting from it.
+    c.addCommands(
+      {
+        {
+          "login",
+          "Login to the server.",
+          [&](const QConsole::Context& ctx) {
+              Q_UNUSED(ctx);
+
+              auto username = c.readLine("Username: ");
+              auto password = c.readPass("Password: ");
+
+              if (username == "root" && password == "123") {
+                  c.setPrompt(QStringLiteral("[%1@%2][%3]: ")
+                                .arg(QConsole::colorize(username.constData(), QConsole::Color::Green),
+                                     QConsole::colorize(serverHost, QConsole::Color::Cyan),
+                                     QConsole::colorize("#", QConsole::Color::Green)));
+              } else {
+                  qCritical() << "Incorrect password!";
+              }
+          },
+        },
+        {
+          "logout",
+          "Logout of the server.",
+          [&](const QConsole::Context& ctx) {
+              ctx.ostream() << "Logging out!" << Qt::endl;
+              c.resetPrompt();
+          },
+        },
+        {
+          "ping",
+          "Ping the server.",
+          [&](const QConsole::Context& ctx) {
+              ctx.ostream() << "Ping!" << Qt::endl;
+          },
+        },
+        {
+          "disconnect",
+          "Disconnect from the server.",
+          [&](const QConsole::Context& ctx) {
+              Q_UNUSED(ctx);
+
+              c.popScope();
+              c.setDefaultPrompt(QStringLiteral("[?][%1]: ").arg(QConsole::colorize("#", QConsole::Color::Red)));
+
+              qInfo() << "Disconnected from server. Online commands have been removed.";
+          },
+        },
+      },
+      "online");
+
     c.addCommand({
       "connect",
       "Connect to the server.",
       [&](const QConsole::Context& ctx) {
           Q_UNUSED(ctx);
 
-          c.setDefaultPrompt(QStringLiteral("[?][%1]: ").arg(QConsole::colorize("#", QConsole::Color::Green)));
-
-          c.addCommand({
-            "login",
-            "Login to the server.",
-            [&](const QConsole::Context& ctx) {
-                Q_UNUSED(ctx);
-
-                auto username = c.readLine("Username: ");
-                auto password = c.readPass("Password: ");
-
-                if (username == "root" && password == "123") {
-                    c.setPrompt(QStringLiteral("[%1@%2][%3]: ")
-                                  .arg(QConsole::colorize(username.constData(), QConsole::Color::Green),
-                                       QConsole::colorize(serverHost, QConsole::Color::Cyan),
-                                       QConsole::colorize("#", QConsole::Color::Green)));
-                } else {
-                    qCritical() << "Incorrect password!";
-                }
-            },
-          });
-
-          c.addCommand({
-            "logout",
-            "Logout of the server.",
-            [&](const QConsole::Context& ctx) {
-                Q_UNUSED(ctx);
-                c.ostream() << "Logging out!" << Qt::endl;
-                c.resetPrompt();
-            },
-          });
-
-          c.addCommand({
-            "ping",
-            "Ping the server.",
-            [&](const QConsole::Context& ctx) {
-                Q_UNUSED(ctx);
-                c.ostream() << "Ping!" << Qt::endl;
-            },
-          });
-
-          c.addCommand({
-            "disconnect",
-            "Disconnect from the server.",
-            [&](const QConsole::Context& ctx) {
-                Q_UNUSED(ctx);
-
-                c.removeCommandByName("login");
-                c.removeCommandByName("logout");
-                c.removeCommandByName("ping");
-                c.removeCommandByName("disconnect");
-
-                c.setDefaultPrompt(QStringLiteral("[?][%1]: ").arg(QConsole::colorize("#", QConsole::Color::Red)));
+          if (c.currentScope() == "online") {
+              qWarning() << "Already connected to server.";
+              return;
+          }
 
-                qInfo() << "Disconnected from server. Online commands have been removed.";
-            },
-          });
+          c.pushScope("online");
+          c.setDefaultPrompt(QStringLiteral("[?][%1]: ").arg(QConsole::colorize("#", QConsole::Color::Green)));
 
           qInfo() << "Connected to server. See 'help' for online commands.";
       },
     });
 
+    // Run "example-complex < commands.txt" as a script.
+    c.setScriptMode(true);
     c.start();
 
     return app.exec();
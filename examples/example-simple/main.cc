@@ -41,7 +41,7 @@ int main(int argc, char** argv)
       "hello-world",
       "Print 'Hello, world!' and arguments.",
       [&](const QConsole::Context& ctx) {
-          c.ostream() << "Hello, World! Arguments:" << ctx.arguments.join(" ") << Qt::endl;
+          ctx.ostream() << "Hello, World! Arguments:" << ctx.arguments.join(" ") << Qt::endl;
       },
     });
 
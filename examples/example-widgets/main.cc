@@ -22,7 +22,6 @@
 // OTHER DEALINGS IN THE SOFTWARE.
 
 #include <QConsole>
-#include <QtCore/QThread>
 #include <QtWidgets/QApplication>
 #include <QtWidgets/QPushButton>
 #include <QtWidgets/QTextEdit>
@@ -36,16 +35,12 @@ int main(int argc, char** argv)
     app.setOrganizationName("example");
     app.setOrganizationDomain("example");
 
-    // We create a new thread for QConsole to reside in to avoid blocking
-    // the main thread.
-    auto thread = new QThread();
-
-    auto c = new QConsole();
-    c->start(); // Start before moving to a new thread.
-    c->moveToThread(thread);
-    c->addDefaultCommands();
-    c->setHistoryFilePath("history.txt");
-    c->setDefaultPrompt(QConsole::colorize(">> ", QConsole::Color::Red));
+    // QConsole reads user input on its own thread and evaluates commands in the
+    // main thread, so it can share the event loop with the widgets.
+    QConsole c;
+    c.addDefaultCommands();
+    c.setHistoryFilePath("history.txt");
+    c.setDefaultPrompt(QConsole::colorize(">> ", QConsole::Color::Red));
 
     auto widget     = new QWidget();
     auto mainLayout = new QVBoxLayout;
@@ -57,19 +52,13 @@ int main(int argc, char** argv)
 
     widget->show();
 
-    c->addCommand({
+    c.addCommand({
       "set-text",
       "Change the text of the QTextEdit!",
-      [&](const QConsole::Context& ctx) {
-          // Note that we have to invoke the method from the main thread since our current
-          // context is the QConsole thread.
-          QMetaObject::invokeMethod(
-            textEdit, [=]() { textEdit->setText(ctx.arguments.join(" ")); }, Qt::QueuedConnection);
-      },
+      [&](const QConsole::Context& ctx) { textEdit->setText(ctx.arguments.join(" ")); },
     });
 
-    // Start the QConsole thread.
-    thread->start();
+    c.start();
 
     return app.exec();
 }
@@ -26,17 +26,58 @@
 #include <stdio.h>
 #include <tsl/htrie_map.h>
 
+#include <QtCore/QBuffer>
+#include <QtCore/QCache>
 #include <QtCore/QCoreApplication>
+#include <QtCore/QDateTime>
+#include <QtCore/QDeadlineTimer>
 #include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QEventLoop>
+#include <QtCore/QFile>
+#include <QtCore/QFutureWatcher>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QMutex>
+#include <QtCore/QPromise>
+#include <QtCore/QSaveFile>
+#include <QtCore/QSemaphore>
 #include <QtCore/QStandardPaths>
+#include <QtCore/QStringEncoder>
+#include <QtCore/QThreadPool>
 #include <QtCore/QTimer>
+#include <QtCore/QVarLengthArray>
+#include <QtNetwork/QLocalServer>
+#include <QtNetwork/QLocalSocket>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <queue>
 #include <regex>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <replxx.hxx>
 
 #ifdef Q_OS_WIN32
+#include <conio.h>
+#include <io.h>
 #include <windows.h>
 #else
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
 #include <termios.h>
 #include <unistd.h>
 #endif
@@ -45,177 +86,5212 @@
 
 using namespace replxx;
 
-class QConsole::Trie : public tsl::htrie_map<char, QConsole::Command>
+// The size of the blocks read by "runScript".
+static constexpr qint64 SCRIPT_BLOCK_SIZE = 64 * 1024;
+
+// The size of the console output buffer, written when full whatever the buffering.
+static constexpr size_t OUTPUT_BLOCK_SIZE = 64 * 1024;
+
+// Check if the standard input is a terminal, rather than a file or a pipe.
+static bool isInteractive()
+{
+#ifdef Q_OS_WIN32
+    return _isatty(_fileno(stdin)) != 0;
+#else
+    return isatty(fileno(stdin)) != 0;
+#endif
+}
+
+// Check if the standard output is a terminal, rather than a file or a pipe.
+static bool isTerminalOutput()
+{
+#ifdef Q_OS_WIN32
+    static const bool terminal = _isatty(_fileno(stdout)) != 0;
+#else
+    static const bool terminal = isatty(fileno(stdout)) != 0;
+#endif
+    return terminal;
+}
+
+// The escape sequences starting text of each style and basic color, "\33[<style>;3<color>m",
+// indexed by style then color.
+static constexpr size_t COLOR_ESCAPE_SIZE = 7;
+static constexpr auto   COLOR_ESCAPES     = []() {
+    std::array<std::array<char, COLOR_ESCAPE_SIZE>, 16> escapes{};
+
+    for (size_t i = 0; i < escapes.size(); ++i) {
+        escapes[i] = { '\33', '[', static_cast<char>('0' + i / 8), ';', '3', static_cast<char>('0' + i % 8), 'm' };
+    }
+
+    return escapes;
+}();
+
+// The escape sequences starting text of each style with a color of the palette, or a 24-bit color.
+static constexpr std::string_view PALETTE_ESCAPES[] = { "\33[0;38;5;", "\33[1;38;5;" };
+static constexpr std::string_view RGB_ESCAPES[]     = { "\33[0;38;2;", "\33[1;38;2;" };
+static constexpr std::string_view RESET_ESCAPE      = "\33[0m";
+
+static inline std::string_view colorEscape(QConsole::Color color, QConsole::Style style)
+{
+    const auto& escape = COLOR_ESCAPES[static_cast<size_t>(style) * 8 + static_cast<size_t>(color)];
+    return std::string_view(escape.data(), escape.size());
+}
+
+// Append text with the given color to a line, without the color if colors are disabled.
+static void appendStyled(std::string& line, std::string_view text, QConsole::Color color, bool colors)
+{
+    if (colors) {
+        line.append(colorEscape(color, QConsole::Style::Bold)).append(text).append(RESET_ESCAPE);
+    } else {
+        line.append(text);
+    }
+}
+
+// Append a duration given in nanoseconds to a line, in the most readable unit.
+static void appendDuration(std::string& line, qint64 duration)
+{
+    char buffer[32];
+
+    if (duration < 1000) {
+        std::snprintf(buffer, sizeof(buffer), "%lldns", static_cast<long long>(duration));
+    } else if (duration < 1000 * 1000) {
+        std::snprintf(buffer, sizeof(buffer), "%.1fus", static_cast<double>(duration) / 1e3);
+    } else if (duration < 1000 * 1000 * 1000) {
+        std::snprintf(buffer, sizeof(buffer), "%.1fms", static_cast<double>(duration) / 1e6);
+    } else {
+        std::snprintf(buffer, sizeof(buffer), "%.2fs", static_cast<double>(duration) / 1e9);
+    }
+
+    line.append(std::max<size_t>(std::strlen(buffer), 9) - std::strlen(buffer), ' ').append(buffer);
+}
+
+// The current time, as written in the history files.
+static std::string currentTimestamp()
+{
+    return QDateTime::currentDateTime().toString(QStringLiteral("yyyy-MM-dd HH:mm:ss.zzz")).toStdString();
+}
+
+// The paint of the error messages.
+static constexpr QConsole::Paint ERROR_PAINT(QConsole::Color::Red, QConsole::Style::Normal);
+
+static inline bool isBlank(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n' || ch == '\v' || ch == '\f';
+}
+
+// The kinds of the tokens of a line: the words, and the operators chaining its commands, which
+// are only found outside of quotes. A quoted ";" is a word like any other.
+enum class TokenKind
 {
+    Word,
+    Sequence,
+    And,
+    Or,
+    Pipe,
 };
 
-class QConsole::Terminal : public replxx::Replxx
+// A word of a line, or one of the operators chaining its commands.
+struct QConsole::Token
 {
+    std::string_view text;
+    TokenKind        kind = TokenKind::Word;
 };
 
-QConsole::QConsole(QObject* parent)
-  : QObject(parent)
-  , m_commands(new Trie())
-  , m_terminal(new Terminal())
-  , m_echo(true)
-  , m_running(false)
-  , m_ostream(stdout)
+// Return the text of an operator.
+static constexpr std::string_view operatorText(TokenKind kind)
 {
-    m_terminal->set_max_hint_rows(0);
-    m_terminal->bind_key_internal(Replxx::KEY::control('N'), "history_next");
-    m_terminal->bind_key_internal(Replxx::KEY::control('P'), "history_previous");
-    m_terminal->set_max_history_size(10000);
-    m_terminal->set_word_break_characters(" \t,%!;:=*~^'\"/?<>|[](){}");
-    m_terminal->set_completion_count_cutoff(256);
-    m_terminal->set_double_tab_completion(false);
-    m_terminal->set_complete_on_empty(true);
-    m_terminal->set_beep_on_ambiguous_completion(true);
-    m_terminal->set_no_color(false);
-    m_terminal->set_unique_history(true);
+    switch (kind) {
+    case TokenKind::Sequence:
+        return ";";
+    case TokenKind::And:
+        return "&&";
+    case TokenKind::Or:
+        return "||";
+    case TokenKind::Pipe:
+        return "|";
+    default:
+        return std::string_view();
+    }
+}
 
-    m_terminal->set_hint_callback([this](std::string const& input, int& input_length, Replxx::Color& color) {
-        if (input_length > 0) {
-            if (const auto& pr = m_commands->equal_prefix_range(input); pr.first != pr.second) {
-                color = Replxx::Color::BROWN;
-                return Replxx::hints_t({ pr.first.key() });
+// Return the operator at the beginning of the text, or "Word" if there's none.
+static inline TokenKind matchOperator(const char* in, const char* end)
+{
+    if (*in == ';') {
+        return TokenKind::Sequence;
+    } else if (*in == '|') {
+        return in + 1 != end && in[1] == '|' ? TokenKind::Or : TokenKind::Pipe;
+    } else if (*in == '&' && in + 1 != end && in[1] == '&') {
+        return TokenKind::And;
+    }
+
+    return TokenKind::Word;
+}
+
+// Split the line into tokens in place, removing the quotes and the escape characters. The tokens
+// are views into the line, which never grows since the unescaped text is shorter than the
+// original. Splitting into tokens with a kind, rather than plain views, also finds the unquoted
+// operators, which are tokens of their own even without blanks around them. Return false if a
+// quote isn't terminated.
+template<typename T>
+static bool tokenize(char* data, size_t size, std::vector<T>& tokens)
+{
+    constexpr bool operators = !std::is_same_v<T, std::string_view>;
+
+    const char* in  = data;
+    const char* end = in + size;
+    char*       out = data;
+
+    while (in != end) {
+        if (isBlank(*in)) {
+            in++;
+            continue;
+        }
+
+        if constexpr (operators) {
+            if (const auto kind = matchOperator(in, end); kind != TokenKind::Word) {
+                tokens.push_back({ operatorText(kind), kind });
+                in += operatorText(kind).size();
+                continue;
             }
         }
 
-        return Replxx::hints_t();
-    });
+        const char* start = out;
+        char        quote = 0;
+
+        for (; in != end; in++) {
+            const char ch = *in;
+
+            if (quote == '\'') {
+                if (ch == '\'') {
+                    quote = 0;
+                } else {
+                    *out++ = ch;
+                }
+            } else if (quote == '"') {
+                if (ch == '"') {
+                    quote = 0;
+                } else if (ch == '\\' && in + 1 != end && (in[1] == '"' || in[1] == '\\')) {
+                    *out++ = *++in;
+                } else {
+                    *out++ = ch;
+                }
+            } else if (ch == '\'' || ch == '"') {
+                quote = ch;
+            } else if (ch == '\\') {
+                if (in + 1 != end) {
+                    *out++ = *++in;
+                }
+            } else if (isBlank(ch) || (operators && matchOperator(in, end) != TokenKind::Word)) {
+                break;
+            } else {
+                *out++ = ch;
+            }
+        }
+
+        if (quote != 0) {
+            return false;
+        }
+
+        tokens.push_back({ std::string_view(start, static_cast<size_t>(out - start)) });
+    }
+
+    return true;
+}
+
+template<typename T>
+static inline bool tokenize(std::string& line, std::vector<T>& tokens)
+{
+    return tokenize(line.data(), line.size(), tokens);
+}
+
+static inline char fold(char ch)
+{
+    return (ch >= 'A' && ch <= 'Z') ? static_cast<char>(ch - 'A' + 'a') : ch;
+}
+
+// Return the number of characters of a UTF-8 string.
+static inline int utf8Length(std::string_view text)
+{
+    return static_cast<int>(std::count_if(text.begin(), text.end(), [](char ch) { return (ch & 0xc0) != 0x80; }));
+}
+
+// Return a mask of the character classes found in the text: one bit per letter (ignoring
+// the case) and digit, the other bytes share the remaining bits. A name can only match a query
+// if its mask contains the mask of the query.
+static inline uint64_t characterClasses(std::string_view text)
+{
+    uint64_t mask = 0;
+
+    for (const auto c : text) {
+        const auto ch = static_cast<unsigned char>(fold(c));
+
+        if (ch >= 'a' && ch <= 'z') {
+            mask |= uint64_t(1) << (ch - 'a');
+        } else if (ch >= '0' && ch <= '9') {
+            mask |= uint64_t(1) << (26 + ch - '0');
+        } else {
+            mask |= uint64_t(1) << (36 + ch % 28);
+        }
+    }
+
+    return mask;
+}
+
+static inline bool isWordBoundary(char previous, char current)
+{
+    return previous == '-' || previous == '_' || previous == '.' || previous == '/' || previous == ':'
+           || previous == ' ' || (previous >= 'a' && previous <= 'z' && current >= 'A' && current <= 'Z');
+}
+
+// Score a name against a query whose characters must appear in the name in the same order.
+// Matches at the start of the name or of one of its words, and consecutive matches, score
+// higher. Names starting with the query come first, then the shorter ones. Return -1 if the
+// name doesn't match.
+static int fuzzyScore(std::string_view query, std::string_view name)
+{
+    if (query.size() > name.size()) {
+        return -1;
+    }
+
+    int    score    = 0;
+    size_t q        = 0;
+    size_t previous = std::string_view::npos;
+
+    for (size_t n = 0; n < name.size() && q < query.size(); ++n) {
+        if (fold(name[n]) != fold(query[q])) {
+            continue;
+        }
+
+        score += 1;
+
+        if (n == 0) {
+            score += 8;
+        } else if (isWordBoundary(name[n - 1], name[n])) {
+            score += 6;
+        }
+
+        if (previous != std::string_view::npos && previous + 1 == n) {
+            score += 4;
+        }
+
+        previous = n;
+        q++;
+    }
+
+    if (q < query.size()) {
+        return -1;
+    }
+
+    if (name.compare(0, query.size(), query) == 0) {
+        score += 100;
+    }
+
+    if (!query.empty()) {
+        score -= static_cast<int>(std::min<size_t>(name.size() - query.size(), 64));
+    }
+
+    return score;
+}
+
+static inline QString toQString(std::string_view view)
+{
+    return QString::fromUtf8(view.data(), static_cast<qsizetype>(view.size()));
+}
+
+// Encode a string to UTF-8 into a buffer that's reused between calls.
+static inline std::string_view toUtf8(const QString& str, std::string& buffer, QStringEncoder& encoder)
+{
+    buffer.resize(static_cast<size_t>(encoder.requiredSpace(str.size())));
+
+    const auto end = encoder.appendToBuffer(buffer.data(), str);
+    return std::string_view(buffer.data(), static_cast<size_t>(end - buffer.data()));
+}
+
+QConsole::Arguments::Arguments(const QList<QString>& arguments)
+{
+    std::vector<std::string>      strings;
+    std::vector<std::string_view> views;
+
+    strings.reserve(static_cast<size_t>(arguments.size()));
+
+    for (const auto& a : arguments) {
+        strings.push_back(a.toStdString());
+    }
+
+    views.assign(strings.begin(), strings.end());
+    assign(views.data(), static_cast<qsizetype>(views.size()));
+}
+
+QConsole::Arguments::Arguments(std::initializer_list<QString> arguments)
+  : Arguments(QList<QString>(arguments))
+{
+}
+
+QConsole::Arguments::Arguments(const std::string_view* views, qsizetype size)
+  : m_views(views)
+  , m_size(size)
+{
+}
+
+QConsole::Arguments::Arguments(const Arguments& other)
+{
+    assign(other.m_views, other.m_size);
+}
+
+QConsole::Arguments::Arguments(Arguments&& other) noexcept
+  : m_storage(std::move(other.m_storage))
+  , m_views(other.m_views)
+  , m_size(other.m_size)
+{
+    other.m_views = nullptr;
+    other.m_size  = 0;
+}
+
+QConsole::Arguments& QConsole::Arguments::operator=(const Arguments& other)
+{
+    if (this != &other) {
+        assign(other.m_views, other.m_size);
+    }
+
+    return *this;
+}
+
+QConsole::Arguments& QConsole::Arguments::operator=(Arguments&& other) noexcept
+{
+    m_storage     = std::move(other.m_storage);
+    m_views       = other.m_views;
+    m_size        = other.m_size;
+    other.m_views = nullptr;
+    other.m_size  = 0;
+    return *this;
+}
+
+void QConsole::Arguments::assign(const std::string_view* views, qsizetype size)
+{
+    auto storage = std::make_unique<Storage>();
+
+    size_t length = 0;
+
+    for (qsizetype i = 0; i < size; ++i) {
+        length += views[i].size();
+    }
+
+    storage->buffer.reserve(length);
+    storage->views.reserve(static_cast<size_t>(size));
+
+    for (qsizetype i = 0; i < size; ++i) {
+        storage->buffer.append(views[i]);
+    }
+
+    size_t offset = 0;
+
+    for (qsizetype i = 0; i < size; ++i) {
+        storage->views.emplace_back(storage->buffer.data() + offset, views[i].size());
+        offset += views[i].size();
+    }
+
+    m_storage = std::move(storage);
+    m_views   = m_storage->views.data();
+    m_size    = size;
+}
+
+bool QConsole::Arguments::parse(std::string_view line, Arguments& arguments)
+{
+    auto storage = std::make_unique<Storage>();
+    storage->buffer.assign(line);
+
+    if (!tokenize(storage->buffer, storage->views)) {
+        return false;
+    }
+
+    arguments.m_storage = std::move(storage);
+    arguments.m_views   = arguments.m_storage->views.data();
+    arguments.m_size    = static_cast<qsizetype>(arguments.m_storage->views.size());
+    return true;
+}
+
+qsizetype QConsole::Arguments::size() const
+{
+    return m_size;
+}
+
+bool QConsole::Arguments::isEmpty() const
+{
+    return m_size == 0;
+}
+
+std::string_view QConsole::Arguments::view(qsizetype i) const
+{
+    Q_ASSERT(i >= 0 && i < m_size);
+    return m_views[i];
+}
+
+QString QConsole::Arguments::at(qsizetype i) const
+{
+    return toQString(view(i));
+}
+
+QString QConsole::Arguments::operator[](qsizetype i) const
+{
+    return at(i);
+}
+
+QString QConsole::Arguments::value(qsizetype i, const QString& defaultValue) const
+{
+    return (i >= 0 && i < m_size) ? at(i) : defaultValue;
+}
+
+QString QConsole::Arguments::join(const QString& separator) const
+{
+    QString result;
+
+    for (qsizetype i = 0; i < m_size; ++i) {
+        if (i > 0) {
+            result.append(separator);
+        }
+
+        result.append(toQString(m_views[i]));
+    }
+
+    return result;
+}
+
+QList<QString> QConsole::Arguments::toList() const
+{
+    QList<QString> result;
+    result.reserve(m_size);
+
+    for (qsizetype i = 0; i < m_size; ++i) {
+        result.append(toQString(m_views[i]));
+    }
+
+    return result;
+}
+
+QConsole::Arguments::operator QList<QString>() const
+{
+    return toList();
+}
+
+const std::string_view* QConsole::Arguments::begin() const
+{
+    return m_views;
+}
+
+const std::string_view* QConsole::Arguments::end() const
+{
+    return m_views + m_size;
+}
+
+// Index is a minimal perfect hash of the command names, built with the "hash, displace and
+// compress" algorithm: the names are hashed into buckets of about four names, then every bucket
+// gets the first seed that sends its names to free slots. A lookup is one hash of the name, two
+// array reads and a single comparison, regardless of the number of commands.
+class QConsole::Index
+{
+public:
+    // Build the index, return false if two names can't be separated.
+    bool build(const std::vector<std::string>& names, const std::vector<const Command*>& commands)
+    {
+        const auto count   = names.size();
+        const auto buckets = (count + 3) / 4;
+
+        m_seeds.clear();
+        m_slots.clear();
+        m_names.clear();
+
+        if (count > std::numeric_limits<uint32_t>::max()) {
+            return false;
+        }
+
+        std::vector<uint64_t>              hashes(count);
+        std::vector<std::vector<uint32_t>> members(buckets);
+
+        for (size_t i = 0; i < count; ++i) {
+            hashes[i] = hash(names[i]);
+            members[hashes[i] % buckets].push_back(static_cast<uint32_t>(i));
+        }
+
+        // Place the largest buckets first, while most of the slots are free.
+        std::vector<uint32_t> order(buckets);
+
+        for (size_t i = 0; i < buckets; ++i) {
+            order[i] = static_cast<uint32_t>(i);
+        }
+
+        std::stable_sort(order.begin(), order.end(),
+                         [&members](uint32_t a, uint32_t b) { return members[a].size() > members[b].size(); });
+
+        m_seeds.assign(buckets, 0);
+        m_slots.assign(count, Slot{ 0, 0, 0, nullptr });
+
+        std::vector<bool>     used(count, false);
+        std::vector<uint32_t> taken;
+
+        for (const auto b : order) {
+            const auto& bucket = members[b];
+
+            if (bucket.empty()) {
+                break;
+            }
+
+            bool placed = false;
+
+            for (uint32_t seed = 0; seed < MAX_SEED && !placed; ++seed) {
+                taken.clear();
+                placed = true;
+
+                for (const auto i : bucket) {
+                    const auto slot = static_cast<uint32_t>(displace(hashes[i], seed) % count);
+
+                    if (used[slot] || std::find(taken.begin(), taken.end(), slot) != taken.end()) {
+                        placed = false;
+                        break;
+                    }
+
+                    taken.push_back(slot);
+                }
+
+                if (placed) {
+                    m_seeds[b] = seed;
+
+                    for (size_t k = 0; k < bucket.size(); ++k) {
+                        const auto& name = names[bucket[k]];
+
+                        used[taken[k]]    = true;
+                        m_slots[taken[k]] = Slot{ hashes[bucket[k]], m_names.size(), name.size(), commands[bucket[k]] };
+                        m_names.append(name);
+                    }
+                }
+            }
+
+            if (!placed) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Return the command with the specified name or nullptr.
+    const Command* find(std::string_view name) const
+    {
+        if (m_slots.empty()) {
+            return nullptr;
+        }
+
+        const auto  h    = hash(name);
+        const auto& slot = m_slots[displace(h, m_seeds[h % m_seeds.size()]) % m_slots.size()];
+
+        if (slot.hash == h && slot.length == name.size()
+            && std::memcmp(m_names.data() + slot.offset, name.data(), name.size()) == 0) {
+            return slot.command;
+        }
+
+        return nullptr;
+    }
+
+private:
+    static constexpr uint32_t MAX_SEED = 1 << 24;
+
+    struct Slot
+    {
+        uint64_t       hash;
+        size_t         offset;
+        size_t         length;
+        const Command* command;
+    };
+
+    // FNV-1a followed by a finalizer, so that every bit of the hash depends on the whole name.
+    static inline uint64_t hash(std::string_view name)
+    {
+        uint64_t h = 14695981039346656037ULL;
+
+        for (const auto ch : name) {
+            h ^= static_cast<unsigned char>(ch);
+            h *= 1099511628211ULL;
+        }
+
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static inline uint64_t displace(uint64_t h, uint32_t seed)
+    {
+        h ^= (static_cast<uint64_t>(seed) + 1) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 31;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        return h;
+    }
+
+    std::vector<uint32_t> m_seeds;
+    std::vector<Slot>     m_slots;
+    std::string           m_names;
+};
+
+class QConsole::Trie : public tsl::htrie_map<char, QConsole::Command>
+{
+public:
+    explicit Trie(std::string_view name = std::string_view())
+      : name(name)
+    {
+        burst_threshold(0);
+        max_load_factor(1.0);
+    }
+
+    // A copy has the commands of the trie, the state derived from them is built again.
+    Trie(const Trie& other)
+      : tsl::htrie_map<char, QConsole::Command>(other)
+      , name(other.name)
+    {
+    }
+
+    Trie& operator=(const Trie&) = delete;
+
+    // The name of the scope, empty for the global scope.
+    const std::string name;
+
+    // The index used for exact lookups while the scope is sealed. It refers to the values of
+    // the trie, which is never modified once it's been published.
+    std::unique_ptr<Index> index;
+
+    // Catalog is a flat copy of the sorted names, their commands and their character classes,
+    // which is faster to scan than the trie when the names are matched against a fuzzy query.
+    // The commands refer to the values of the trie, like the index.
+    struct Catalog
+    {
+        std::vector<std::string>    names;
+        std::vector<const Command*> commands;
+        std::vector<uint64_t>       masks;
+    };
+
+    // Return the catalog, building it the first time it's needed. The sessions reading the same
+    // snapshot from several threads build it once.
+    const Catalog& flatten() const
+    {
+        std::call_once(m_flattened, [this]() {
+            std::vector<std::pair<std::string, const Command*>> entries;
+            entries.reserve(size());
+
+            for (auto iter = begin(); iter != end(); ++iter) {
+                entries.emplace_back(iter.key(), &iter.value());
+            }
+
+            std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+            m_catalog = std::make_unique<Catalog>();
+            m_catalog->names.reserve(entries.size());
+            m_catalog->commands.reserve(entries.size());
+            m_catalog->masks.reserve(entries.size());
+
+            for (auto& [name, command] : entries) {
+                m_catalog->masks.push_back(characterClasses(name));
+                m_catalog->names.push_back(std::move(name));
+                m_catalog->commands.push_back(command);
+            }
+        });
+
+        return *m_catalog;
+    }
+
+    // Build the index from the current content of the trie.
+    void seal()
+    {
+        std::vector<std::string>    names;
+        std::vector<const Command*> commands;
+
+        names.reserve(size());
+        commands.reserve(size());
+
+        for (auto iter = begin(); iter != end(); ++iter) {
+            names.push_back(iter.key());
+            commands.push_back(&iter.value());
+        }
+
+        auto i = std::make_unique<Index>();
+
+        if (i->build(names, commands)) {
+            index = std::move(i);
+        }
+    }
+
+    // Return the command with the specified name or nullptr.
+    const Command* lookup(std::string_view name) const
+    {
+        if (index) {
+            return index->find(name);
+        }
+
+        const auto& iter = longest_prefix(name);
+
+        if (iter != cend() && iter.key().length() == name.size()) {
+            return &iter.value();
+        }
+
+        return nullptr;
+    }
+
+private:
+    mutable std::once_flag           m_flattened;
+    mutable std::unique_ptr<Catalog> m_catalog;
+};
+
+// Registry holds the commands shared by the sessions, in scopes: the global scope and the named
+// scopes that each session activates on top of it. It's read through immutable snapshots. The
+// mutations are made on a draft, which copies a scope the first time it's modified after the
+// previous snapshot, and the draft is published as the next snapshot when it's first read. The
+// scopes that weren't modified are shared by the snapshots, so the sessions cost one registry's
+// memory. Only the writers, and the first reader after a mutation, take the lock: the readers
+// check the version of the registry, and keep the snapshot they hold while it's current.
+class QConsole::Registry
+{
+public:
+    // Snapshot is an immutable state of the registry.
+    struct Snapshot
+    {
+        std::shared_ptr<const Trie>                                  global;
+        std::unordered_map<std::string, std::shared_ptr<const Trie>> scopes;
+
+        // Return the scope with the specified name, the global scope if the name is empty, or
+        // nullptr if it doesn't exist.
+        const Trie* scope(const std::string& name) const
+        {
+            if (name.empty()) {
+                return global.get();
+            }
+
+            const auto iter = scopes.find(name);
+            return iter != scopes.end() ? iter->second.get() : nullptr;
+        }
+    };
+
+    Registry()
+    {
+        auto first    = std::make_shared<Snapshot>();
+        first->global = std::make_shared<Trie>();
+        m_draft       = first;
+        m_current     = std::move(first);
+    }
+
+    // Return the version of the registry, which changes whenever a snapshot is published or
+    // a mutation is pending.
+    quint64 version() const
+    {
+        return m_version.load(std::memory_order_acquire);
+    }
+
+    // Return the current snapshot, publishing the pending mutations first, and its version. The
+    // version is loaded before the snapshot: a mutation starting in between changes the version,
+    // so the caller loads the snapshot again instead of keeping an older one.
+    std::shared_ptr<const Snapshot> snapshot(quint64& version)
+    {
+        version = m_version.load(std::memory_order_acquire);
+
+        if (m_dirty.load(std::memory_order_acquire)) {
+            QMutexLocker lock(&m_mutex);
+            publish();
+            version = m_version.load(std::memory_order_acquire);
+        }
+
+        return std::atomic_load(&m_current);
+    }
+
+    // Modify a scope, creating it if needed. The modification is given the scope, which it can
+    // modify freely, and whether it was sealed. Return false if the scope doesn't exist and it
+    // shouldn't be created.
+    template<typename F>
+    bool modify(const QString& name, bool create, F&& modification)
+    {
+        QMutexLocker lock(&m_mutex);
+
+        const auto slot = draftScope(name.toStdString(), create);
+
+        if (slot == nullptr) {
+            return false;
+        }
+
+        // The modified scope is unsealed, like a copy of it.
+        const bool sealed = (*slot)->index != nullptr;
+        auto&      trie   = writable(*slot);
+
+        trie.index.reset();
+        modification(trie, sealed);
+        return true;
+    }
+
+    // Create a scope if it doesn't exist yet.
+    void create(const QString& name)
+    {
+        QMutexLocker lock(&m_mutex);
+
+        const auto  key      = name.toStdString();
+        const auto& snapshot = m_dirty.load(std::memory_order_relaxed) ? *m_draft : *m_current;
+
+        if (snapshot.scope(key) == nullptr) {
+            draftScope(key, true);
+        }
+    }
+
+    // Remove a scope and its commands.
+    void remove(const QString& name)
+    {
+        QMutexLocker lock(&m_mutex);
+
+        if (const auto key = name.toStdString(); !key.empty() && draft().scopes.erase(key) > 0) {
+            m_fresh.erase(key);
+        }
+    }
+
+    // Seal every scope that isn't sealed yet.
+    void seal()
+    {
+        QMutexLocker lock(&m_mutex);
+
+        auto& snapshot = draft();
+
+        if (snapshot.global->index == nullptr) {
+            writable(snapshot.global).seal();
+        }
+
+        for (auto& [name, trie] : snapshot.scopes) {
+            if (trie->index == nullptr) {
+                writable(trie).seal();
+            }
+        }
+    }
+
+private:
+    // Return the draft, starting one from the current snapshot if needed.
+    Snapshot& draft()
+    {
+        if (!m_dirty.load(std::memory_order_relaxed)) {
+            m_draft = std::make_shared<Snapshot>(*m_current);
+            m_fresh.clear();
+            m_dirty.store(true, std::memory_order_release);
+            m_version.fetch_add(1, std::memory_order_acq_rel);
+        }
+
+        return *m_draft;
+    }
+
+    // Return the slot of a scope in the draft, or nullptr if it doesn't exist and it shouldn't
+    // be created.
+    std::shared_ptr<const Trie>* draftScope(const std::string& name, bool create)
+    {
+        auto& snapshot = draft();
+
+        if (name.empty()) {
+            return &snapshot.global;
+        }
+
+        if (const auto iter = snapshot.scopes.find(name); iter != snapshot.scopes.end()) {
+            return &iter->second;
+        }
+
+        if (!create) {
+            return nullptr;
+        }
+
+        auto trie = std::make_shared<Trie>(name);
+        m_fresh.insert(name);
+        return &snapshot.scopes.emplace(name, std::move(trie)).first->second;
+    }
+
+    // Return a scope of the draft that can be modified, copying it if it's been published.
+    Trie& writable(std::shared_ptr<const Trie>& slot)
+    {
+        if (m_fresh.insert(slot->name).second) {
+            slot = std::make_shared<Trie>(*slot);
+        }
+
+        // Nothing but the draft refers to a scope created or copied since the last snapshot.
+        return const_cast<Trie&>(*slot);
+    }
+
+    // Publish the draft as the current snapshot. The lock must be held.
+    void publish()
+    {
+        if (m_dirty.load(std::memory_order_relaxed)) {
+            std::atomic_store(&m_current, std::shared_ptr<const Snapshot>(m_draft));
+            m_fresh.clear();
+            m_version.fetch_add(1, std::memory_order_acq_rel);
+            m_dirty.store(false, std::memory_order_release);
+        }
+    }
+
+    QMutex                          m_mutex;
+    std::shared_ptr<const Snapshot> m_current;
+    std::shared_ptr<Snapshot>       m_draft;
+    std::unordered_set<std::string> m_fresh;
+    std::atomic<quint64>            m_version{ 0 };
+    std::atomic<bool>               m_dirty{ false };
+};
+
+// Scopes holds what a session selects in the registry: the scopes it activated, from the
+// oldest to the newest, and the commands it used recently, which rank higher in completions.
+// The console thread modifies them and the terminal callbacks read them on the reader thread:
+// the list of scopes is replaced as a whole, and its version tells the readers when to load it.
+class QConsole::Scopes
+{
+public:
+    Scopes()
+      : m_names(std::make_shared<std::vector<std::string>>())
+    {
+    }
+
+    quint64 version() const
+    {
+        return m_version.load(std::memory_order_acquire);
+    }
+
+    std::shared_ptr<const std::vector<std::string>> names() const
+    {
+        return std::atomic_load(&m_names);
+    }
+
+    // Replace the list of scopes with a modified copy of it.
+    template<typename F>
+    void modify(F&& modification)
+    {
+        auto names = std::make_shared<std::vector<std::string>>(*m_names);
+        modification(*names);
+        std::atomic_store(&m_names, std::shared_ptr<const std::vector<std::string>>(std::move(names)));
+        m_version.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    // Remember that a command was used.
+    void used(std::string_view name)
+    {
+        QMutexLocker lock(&m_mutex);
+
+        if (m_recent.empty() || m_recent.back() != name) {
+            if (m_recent.size() == MAX_RECENT) {
+                m_recent.pop_front();
+            }
+
+            m_recent.emplace_back(name);
+        }
+    }
+
+    // Return the rank of the recently used commands, the most recent one ranking highest.
+    std::unordered_map<std::string, int> recency() const
+    {
+        QMutexLocker lock(&m_mutex);
+
+        std::unordered_map<std::string, int> ranks;
+
+        for (size_t i = 0; i < m_recent.size(); ++i) {
+            ranks[m_recent[i]] = static_cast<int>(i + 1);
+        }
+
+        return ranks;
+    }
+
+private:
+    // The number of recently used commands to remember.
+    static constexpr size_t MAX_RECENT = 32;
+
+    std::shared_ptr<const std::vector<std::string>> m_names;
+    std::atomic<quint64>                            m_version{ 0 };
+    mutable QMutex                                  m_mutex;
+    std::deque<std::string>                         m_recent;
+};
+
+// View is what a session sees of the registry from one thread: a snapshot, and the layers of
+// the scopes the session activated in it, from the global scope at the bottom to the newest
+// scope at the top. A view isn't shared between threads. Refreshing it costs two atomic loads
+// when neither the registry nor the scopes changed, so lookups never wait for a writer.
+class QConsole::View
+{
+public:
+    View(Registry& registry, const Scopes& scopes)
+      : m_registry(registry)
+      , m_scopes(scopes)
+    {
+    }
+
+    // Load the current snapshot and scopes if they changed.
+    View& refresh()
+    {
+        if (m_registry.version() == m_registryVersion && m_scopes.version() == m_scopesVersion && m_snapshot) {
+            return *this;
+        }
+
+        m_scopesVersion = m_scopes.version();
+        m_snapshot      = m_registry.snapshot(m_registryVersion);
+        m_layers.assign(1, m_snapshot->global.get());
+
+        // The scopes removed from the registry are skipped.
+        for (const auto& name : *m_scopes.names()) {
+            if (const auto trie = m_snapshot->scope(name); trie != nullptr) {
+                m_layers.push_back(trie);
+            }
+        }
+
+        m_generation++;
+        return *this;
+    }
+
+    // Return the snapshot, which keeps the commands it holds alive while they're used.
+    const std::shared_ptr<const Registry::Snapshot>& snapshot() const
+    {
+        return m_snapshot;
+    }
+
+    // Return the layers, from the bottom to the top.
+    const std::vector<const Trie*>& layers() const
+    {
+        return m_layers;
+    }
+
+    // Return a number that changes whenever the layers change, so the state derived from them
+    // outside of the view knows when to start over.
+    quint64 generation() const
+    {
+        return m_generation;
+    }
+
+    // Return the command with the specified name, starting from the top layer.
+    const Command* find(std::string_view name) const
+    {
+        for (auto iter = m_layers.rbegin(); iter != m_layers.rend(); ++iter) {
+            if (const auto c = (*iter)->lookup(name); c != nullptr) {
+                return c;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // Check if a command is shadowed by a command of a layer above the specified one.
+    static bool shadowed(const std::vector<const Trie*>& layers, std::string_view name, size_t layer)
+    {
+        for (auto i = layer + 1; i < layers.size(); ++i) {
+            if (layers[i]->lookup(name) != nullptr) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Return the names of the available commands that best match a query, at most "limit" of
+    // them, from the best match to the worst. The catalogs are first filtered by character
+    // classes, a pass that the compiler can vectorize, then the remaining names are scored and
+    // the best ones are kept in a bounded heap.
+    std::vector<std::string> complete(std::string_view query, size_t limit)
+    {
+        struct Candidate
+        {
+            int                score;
+            const std::string* name;
+        };
+
+        const auto better = [](const Candidate& a, const Candidate& b) {
+            return a.score != b.score ? a.score > b.score : *a.name < *b.name;
+        };
+
+        // The top of the heap is the worst of the best candidates.
+        std::priority_queue<Candidate, std::vector<Candidate>, decltype(better)> heap(better);
+
+        const auto recency = m_scopes.recency();
+        const auto mask    = characterClasses(query);
+
+        for (size_t l = 0; l < m_layers.size(); ++l) {
+            const auto& catalog = m_layers[l]->flatten();
+            const auto  count   = catalog.masks.size();
+
+            m_matches.resize(count);
+
+            for (size_t i = 0; i < count; ++i) {
+                m_matches[i] = (catalog.masks[i] & mask) == mask;
+            }
+
+            for (size_t i = 0; i < count; ++i) {
+                if (!m_matches[i]) {
+                    continue;
+                }
+
+                const auto& name  = catalog.names[i];
+                auto        score = fuzzyScore(query, name);
+
+                if (score < 0 || (l + 1 < m_layers.size() && shadowed(m_layers, name, l))) {
+                    continue;
+                }
+
+                if (const auto iter = recency.find(name); iter != recency.end()) {
+                    score += iter->second;
+                }
+
+                if (const Candidate c{ score, &name }; heap.size() < limit) {
+                    heap.push(c);
+                } else if (better(c, heap.top())) {
+                    heap.pop();
+                    heap.push(c);
+                }
+            }
+        }
+
+        std::vector<std::string> names(heap.size());
+
+        for (auto i = names.size(); i-- > 0;) {
+            names[i] = *heap.top().name;
+            heap.pop();
+        }
+
+        return names;
+    }
+
+private:
+    Registry&                                 m_registry;
+    const Scopes&                             m_scopes;
+    std::shared_ptr<const Registry::Snapshot> m_snapshot;
+    std::vector<const Trie*>                  m_layers;
+    std::vector<uint8_t>                      m_matches;
+    quint64                                   m_registryVersion = 0;
+    quint64                                   m_scopesVersion   = 0;
+    quint64                                   m_generation      = 0;
+};
+
+class QConsole::Terminal : public replxx::Replxx
+{
+};
+
+// MessageQueue is a bounded multi-producer single-consumer queue of lines waiting to be printed.
+// Any thread can push to it without taking a lock (see Dmitry Vyukov's bounded MPMC queue), while
+// the console thread drains it in batches. When the queue is full, new lines are dropped and
+// counted instead of growing the memory usage.
+class QConsole::MessageQueue
+{
+public:
+    // The maximum number of lines waiting to be printed, must be a power of two.
+    static constexpr size_t CAPACITY = 4096;
+
+    MessageQueue()
+      : m_cells(new Cell[CAPACITY])
+      , m_tail(0)
+      , m_head(0)
+      , m_dropped(0)
+      , m_scheduled(false)
+    {
+        for (size_t i = 0; i < CAPACITY; ++i) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Push a line to the queue. This method can be called from any thread.
+    bool push(QByteArray&& message)
+    {
+        auto  pos  = m_tail.load(std::memory_order_relaxed);
+        Cell* cell = nullptr;
+
+        for (;;) {
+            cell = &m_cells[pos & (CAPACITY - 1)];
+
+            const auto seq = cell->sequence.load(std::memory_order_acquire);
+            const auto dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+            if (dif == 0) {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->message = std::move(message);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Pop a line from the queue. This method must only be called from the console thread.
+    bool pop(QByteArray& message)
+    {
+        auto cell = &m_cells[m_head & (CAPACITY - 1)];
+
+        if (cell->sequence.load(std::memory_order_acquire) != m_head + 1) {
+            return false;
+        }
+
+        message = std::move(cell->message);
+        cell->sequence.store(m_head + CAPACITY, std::memory_order_release);
+        m_head++;
+        return true;
+    }
+
+    // Return the number of lines dropped since the last call.
+    size_t takeDropped()
+    {
+        return m_dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+    // Return true if the caller is responsible for scheduling a drain of the queue.
+    bool schedule()
+    {
+        return !m_scheduled.exchange(true, std::memory_order_acq_rel);
+    }
+
+    // Mark the queue as drained, new lines will schedule a drain again. This is a read-modify-write
+    // like "schedule": a producer that still sees a drain scheduled pushed its line before this,
+    // so the drain that follows sees the line.
+    void unschedule()
+    {
+        m_scheduled.exchange(false, std::memory_order_acq_rel);
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        QByteArray          message;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    std::atomic<size_t>     m_tail;
+    size_t                  m_head;
+    std::atomic<size_t>     m_dropped;
+    std::atomic<bool>       m_scheduled;
+};
+
+// Cursor follows the first word of the input line across keystrokes for the hint and the
+// highlighter. It keeps, for each layer, the range of the catalog names starting with the word.
+// Most keystrokes append a character to the word, which can only narrow the ranges, so they're
+// searched again within their previous bounds. Any other edit, or a change of the registry,
+// starts over from the whole catalogs.
+class QConsole::Cursor
+{
+public:
+    // Move the cursor to the first word of the input, as seen by the view.
+    void update(const View& view, std::string_view input)
+    {
+        const auto word = input.substr(0, std::min(input.find_first_of(" \t"), input.size()));
+
+        if (view.generation() != m_generation || word.compare(0, m_word.size(), m_word) != 0
+            || word.size() < m_word.size()) {
+            reset(view);
+        } else if (word.size() == m_word.size()) {
+            return;
+        }
+
+        m_word.assign(word);
+        m_command = nullptr;
+        m_hint    = nullptr;
+
+        const auto startsWithWord = [word](const std::string& name) {
+            return std::string_view(name).substr(0, word.size()) == word;
+        };
+
+        for (auto l = m_catalogs.size(); l-- > 0;) {
+            const auto& names = m_catalogs[l]->names;
+            auto& [first, last] = m_ranges[l];
+
+            const auto lower = std::lower_bound(names.begin() + first, names.begin() + last, word,
+                                                [](const std::string& name, std::string_view w) { return name < w; });
+            const auto upper = std::partition_point(lower, names.begin() + last, startsWithWord);
+
+            first = static_cast<size_t>(lower - names.begin());
+            last  = static_cast<size_t>(upper - names.begin());
+
+            if (first == last) {
+                continue;
+            }
+
+            if (m_hint == nullptr) {
+                m_hint = &names[first];
+            }
+
+            // A name equal to the word sorts before the other names starting with it.
+            if (m_command == nullptr && names[first].size() == word.size()) {
+                m_command = m_catalogs[l]->commands[first];
+            }
+        }
+    }
+
+    // Return the first word of the input.
+    std::string_view word() const
+    {
+        return m_word;
+    }
+
+    // Return the command named by the word, or nullptr.
+    const Command* command() const
+    {
+        return m_command;
+    }
+
+    // Return the first name starting with the word in the topmost layer that has one, or nullptr.
+    const std::string* hint() const
+    {
+        return m_hint;
+    }
+
+private:
+    struct Range
+    {
+        size_t first;
+        size_t last;
+    };
+
+    void reset(const View& view)
+    {
+        m_generation = view.generation();
+        m_word.clear();
+        m_catalogs.clear();
+        m_ranges.clear();
+
+        for (const auto trie : view.layers()) {
+            const auto& catalog = trie->flatten();
+
+            m_catalogs.push_back(&catalog);
+            m_ranges.push_back({ 0, catalog.names.size() });
+        }
+    }
+
+    quint64                           m_generation = 0;
+    std::string                       m_word;
+    std::vector<const Trie::Catalog*> m_catalogs;
+    std::vector<Range>                m_ranges;
+    const Command*                    m_command = nullptr;
+    const std::string*                m_hint    = nullptr;
+};
+
+// Completer keeps track of the argument completion requests. The terminal asks for completions
+// on the reader thread, which can't wait for a completion callback: a request is sent to the
+// console thread instead and nothing is completed until the candidates are ready, then they're
+// cached and the completion is triggered again. Only one request is pending at a time and it's
+// canceled as soon as the line changes or is submitted.
+class QConsole::Completer
+{
+public:
+    // Look up the candidates for a word, the key identifying the command and the arguments
+    // before the word. The candidates found for a prefix of the word are narrowed down.
+    bool cached(const QByteArray& key, const QString& word, QList<QString>& candidates)
+    {
+        QMutexLocker lock(&m_mutex);
+
+        // The candidates that just arrived are used once even if they aren't cached.
+        if (m_ready && m_readyKey == key && m_ready->word == word) {
+            candidates = std::move(m_ready->candidates);
+            m_ready.reset();
+            return true;
+        }
+
+        const auto entry = m_cache.object(key);
+
+        if (entry == nullptr || entry->expiry.hasExpired() || !word.startsWith(entry->word)) {
+            return false;
+        }
+
+        candidates.clear();
+
+        for (const auto& candidate : std::as_const(entry->candidates)) {
+            if (candidate.startsWith(word)) {
+                candidates.append(candidate);
+            }
+        }
+
+        return true;
+    }
+
+    // Return a new request for the line, or 0 if one is already pending for it. The pending
+    // request for another line is canceled.
+    quint64 request(std::string_view line)
+    {
+        QMutexLocker lock(&m_mutex);
+
+        if (m_pending && m_line == line) {
+            return 0;
+        }
+
+        cancel();
+        m_pending = true;
+        m_line.assign(line);
+        m_edited.assign(line);
+        return m_request;
+    }
+
+    // Attach the future of a request, return false if the request isn't pending anymore.
+    bool started(quint64 request, const QFuture<QList<QString>>& future)
+    {
+        QMutexLocker lock(&m_mutex);
+
+        if (!m_pending || request != m_request) {
+            return false;
+        }
+
+        m_future = future;
+        return true;
+    }
+
+    // Store the candidates of a request, return false if the request isn't pending anymore.
+    bool finish(quint64 request, const QByteArray& key, const QString& word, QList<QString>&& candidates, int cacheTime)
+    {
+        QMutexLocker lock(&m_mutex);
+
+        if (!m_pending || request != m_request) {
+            return false;
+        }
+
+        m_pending = false;
+        m_future  = QFuture<QList<QString>>();
+
+        if (cacheTime > 0) {
+            m_cache.insert(key, new Entry{ word, candidates, QDeadlineTimer(cacheTime) });
+        }
+
+        m_ready    = std::make_unique<Entry>(Entry{ word, std::move(candidates), QDeadlineTimer() });
+        m_readyKey = key;
+        return true;
+    }
+
+    // Cancel the pending request unless it was made for the specified line.
+    void edited(std::string_view line)
+    {
+        QMutexLocker lock(&m_mutex);
+
+        m_edited.assign(line);
+
+        if (m_pending && m_line != line) {
+            cancel();
+        }
+    }
+
+    // Cancel the pending request, the line being edited was submitted.
+    void submitted()
+    {
+        QMutexLocker lock(&m_mutex);
+
+        m_edited.clear();
+
+        if (m_pending) {
+            cancel();
+        }
+    }
+
+    // Check if the line of the last request is still the line being edited, so its candidates
+    // can be shown.
+    bool editing()
+    {
+        QMutexLocker lock(&m_mutex);
+        return !m_edited.empty() && m_edited == m_line;
+    }
+
+private:
+    struct Entry
+    {
+        QString        word;
+        QList<QString> candidates;
+        QDeadlineTimer expiry;
+    };
+
+    // The number of argument lists whose candidates are cached.
+    static constexpr qsizetype CACHE_SIZE = 64;
+
+    void cancel()
+    {
+        m_future.cancel();
+        m_future  = QFuture<QList<QString>>();
+        m_pending = false;
+        m_request++;
+    }
+
+    QMutex                    m_mutex;
+    QCache<QByteArray, Entry> m_cache{ CACHE_SIZE };
+    std::unique_ptr<Entry>    m_ready;
+    QByteArray                m_readyKey;
+    std::string               m_line;
+    std::string               m_edited;
+    QFuture<QList<QString>>   m_future;
+    quint64                   m_request = 1;
+    bool                      m_pending = false;
+};
+
+// HistoryLine is an entry of the history file and the time it was evaluated at, which is empty
+// when the file doesn't have it.
+struct QConsole::HistoryLine
+{
+    std::string timestamp;
+    std::string text;
+};
+
+// Journal keeps the history file up to date as lines are evaluated: every line is appended
+// to the file right away, and the file is never rewritten on exit. It's compacted on a thread
+// pool once it holds twice as many lines as the history, dropping the oldest lines and, if the
+// history is unique, the duplicates. The compacted file is written while lines are still
+// appended to the journal, and only the final catch-up with these lines and the replacement of
+// the file block appending. Every entry is preceded by a "### " line holding the time it was
+// evaluated at, like in the files written by replxx, so the history keeps it across restarts.
+//
+// A shared journal is written by several sessions at once. They take an advisory lock on a
+// lock file next to it before touching it, and each one reads the lines appended by the others
+// from the offset where it stopped reading. A compacted file starts with a marker line, so a
+// session notices that the file was replaced when its first line changes.
+class QConsole::Journal
+{
+public:
+    // The lines appended by the other sessions since the last read. When the file was
+    // compacted, "reset" is set and the lines are the whole content of the file.
+    struct Tail
+    {
+        bool                     reset = false;
+        std::vector<HistoryLine> lines;
+    };
+
+    ~Journal()
+    {
+        close();
+    }
+
+    // Set whether the journal is shared with other sessions, before opening it.
+    void setShared(bool shared)
+    {
+        m_shared = shared;
+    }
+
+    bool shared() const
+    {
+        return m_shared;
+    }
+
+    // Open the journal at the specified path and return its lines, from the oldest to the newest.
+    std::vector<HistoryLine> open(const QString& path)
+    {
+        close();
+
+        QMutexLocker             lock(&m_mutex);
+        std::vector<HistoryLine> lines;
+
+        m_path = path;
+
+        if (m_shared) {
+            m_lockFile.setFileName(path + QStringLiteral(".lock"));
+            m_offset = 0;
+            m_head.clear();
+            m_stale = false;
+
+            // Without its lock file, the journal is neither read nor written.
+            if (m_lockFile.open(QIODevice::ReadWrite)) {
+                FileLock fileLock(m_lockFile);
+                lines = read().lines;
+            }
+        } else {
+            lines = load(path);
+
+            // Only the lines that a compaction could keep are remembered.
+            const auto first = lines.size() > m_maxSize * 2 ? lines.size() - m_maxSize * 2 : 0;
+            m_entries.assign(lines.begin() + static_cast<std::ptrdiff_t>(first), lines.end());
+
+            m_file.setFileName(path);
+            m_file.open(QIODevice::WriteOnly | QIODevice::Append);
+        }
+
+        m_lines = lines.size();
+
+        lock.unlock();
+
+        compactIfNeeded();
+        return lines;
+    }
+
+    // Append a line to the journal and return the lines appended by the other sessions.
+    Tail append(const HistoryLine& line)
+    {
+        Tail tail;
+
+        {
+            QMutexLocker lock(&m_mutex);
+
+            if (m_shared && m_lockFile.isOpen()) {
+                FileLock fileLock(m_lockFile);
+
+                tail = read();
+
+                if (QFile file(m_path); file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+                    write(file, line);
+                    m_offset = file.size();
+                    m_head   = head(file);
+                }
+            } else if (m_file.isOpen()) {
+                write(m_file, line);
+
+                // The compaction writes these lines again before replacing the file.
+                if (m_compacting) {
+                    m_appended.emplace_back(line);
+                }
+            } else {
+                return tail;
+            }
+
+            m_lines++;
+        }
+
+        if (!m_shared) {
+            m_entries.emplace_back(line);
+
+            if (m_entries.size() > m_maxSize * 2) {
+                m_entries.pop_front();
+            }
+        }
+
+        compactIfNeeded();
+        return tail;
+    }
+
+    // Return the lines appended by the other sessions, if the journal is shared.
+    Tail tail()
+    {
+        QMutexLocker lock(&m_mutex);
+
+        // Checking the size is cheaper than locking the file.
+        if (!m_shared || !m_lockFile.isOpen() || (!m_stale && QFileInfo(m_path).size() == m_offset)) {
+            return Tail();
+        }
+
+        FileLock fileLock(m_lockFile);
+        return read();
+    }
+
+    void setMaxSize(size_t size)
+    {
+        m_maxSize = std::max<size_t>(size, 1);
+    }
+
+    void setUnique(bool unique)
+    {
+        m_unique = unique;
+    }
+
+    // Wait for the compaction, if any, and close the file.
+    void close()
+    {
+        m_compaction.waitForFinished();
+        m_entries.clear();
+
+        QMutexLocker lock(&m_mutex);
+        m_file.close();
+        m_lockFile.close();
+    }
+
+    // The future of the last compaction, which is true if the file was compacted.
+    QFuture<bool> compaction() const
+    {
+        return m_compaction;
+    }
+
+private:
+    // FileLock holds the advisory lock of a shared journal for as long as it lives. Readers that
+    // don't modify the journal take a shared lock.
+    class FileLock
+    {
+    public:
+        explicit FileLock(QFile& file, bool exclusive = true)
+          : m_handle(file.handle())
+        {
+#ifdef Q_OS_WIN32
+            OVERLAPPED overlapped = {};
+            const auto flags      = exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0;
+            LockFileEx(reinterpret_cast<HANDLE>(_get_osfhandle(m_handle)), flags, 0, 1, 0, &overlapped);
+#else
+            while (flock(m_handle, exclusive ? LOCK_EX : LOCK_SH) == -1 && errno == EINTR) {
+            }
+#endif
+        }
+
+        ~FileLock()
+        {
+#ifdef Q_OS_WIN32
+            OVERLAPPED overlapped = {};
+            UnlockFileEx(reinterpret_cast<HANDLE>(_get_osfhandle(m_handle)), 0, 1, 0, &overlapped);
+#else
+            flock(m_handle, LOCK_UN);
+#endif
+        }
+
+    private:
+        Q_DISABLE_COPY(FileLock)
+
+        int m_handle;
+    };
+
+    // The longest first line compared to notice that a shared journal was replaced.
+    static constexpr qint64 MAX_HEAD_SIZE = 256;
+
+    // The start of the marker line of a compacted shared journal.
+    static constexpr std::string_view MARKER_PREFIX = "### qconsole ";
+
+    // Parse the lines of a journal, the "### " line preceding an entry being its timestamp.
+    static void parse(std::string_view data, std::vector<HistoryLine>& lines)
+    {
+        std::string_view timestamp;
+
+        while (!data.empty()) {
+            const auto end  = data.find('\n');
+            auto       line = data.substr(0, end);
+
+            data.remove_prefix(end == std::string_view::npos ? data.size() : end + 1);
+
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+
+            if (line.rfind(MARKER_PREFIX, 0) == 0) {
+                timestamp = std::string_view();
+            } else if (line.rfind("### ", 0) == 0) {
+                timestamp = line.substr(4);
+            } else if (!line.empty()) {
+                lines.push_back({ std::string(timestamp), std::string(line) });
+                timestamp = std::string_view();
+            }
+        }
+    }
+
+    // Read the lines of a file from an offset, through a memory mapping when possible.
+    static void parse(QFile& file, qint64 offset, std::vector<HistoryLine>& lines)
+    {
+        const auto size = file.size() - offset;
+
+        if (size <= 0) {
+            return;
+        }
+
+        if (const auto data = file.map(offset, size); data != nullptr) {
+            parse(std::string_view(reinterpret_cast<const char*>(data), static_cast<size_t>(size)), lines);
+            file.unmap(data);
+        } else if (file.seek(offset)) {
+            const auto content = file.read(size);
+            parse(std::string_view(content.constData(), static_cast<size_t>(content.size())), lines);
+        }
+    }
+
+    static std::vector<HistoryLine> load(const QString& path)
+    {
+        std::vector<HistoryLine> lines;
+
+        if (QFile file(path); file.open(QIODevice::ReadOnly)) {
+            parse(file, 0, lines);
+        }
+
+        return lines;
+    }
+
+    static QByteArray head(QFile& file)
+    {
+        if (QFile f(file.fileName()); f.open(QIODevice::ReadOnly)) {
+            return f.readLine(MAX_HEAD_SIZE);
+        }
+
+        return QByteArray();
+    }
+
+    // Keep the newest lines, only the last occurrence of each one if the history is unique.
+    template<typename Lines>
+    static std::vector<HistoryLine> select(const Lines& lines, size_t maxSize, bool unique)
+    {
+        std::vector<HistoryLine>             result;
+        std::unordered_set<std::string_view> seen;
+
+        result.reserve(std::min(lines.size(), maxSize));
+
+        for (auto iter = lines.rbegin(); iter != lines.rend() && result.size() < maxSize; ++iter) {
+            if (!unique || seen.insert(iter->text).second) {
+                result.push_back(*iter);
+            }
+        }
+
+        std::reverse(result.begin(), result.end());
+        return result;
+    }
+
+    // Read the lines appended to a shared journal since the last read. The mutex and the file
+    // lock must be held.
+    Tail read()
+    {
+        Tail  tail;
+        QFile file(m_path);
+
+        if (!file.open(QIODevice::ReadOnly)) {
+            return tail;
+        }
+
+        const auto first = file.readLine(MAX_HEAD_SIZE);
+
+        if (m_stale || file.size() < m_offset || (m_offset > 0 && first != m_head)) {
+            tail.reset = true;
+            m_offset   = 0;
+            m_lines    = 0;
+            m_stale    = false;
+        }
+
+        parse(file, m_offset, tail.lines);
+
+        m_offset = file.size();
+        m_head   = first;
+        m_lines += tail.lines.size();
+        return tail;
+    }
+
+    // Format a line as written to the file, after its timestamp if it has one.
+    static void format(std::string& buffer, const HistoryLine& line)
+    {
+        buffer.clear();
+
+        if (!line.timestamp.empty()) {
+            buffer.append("### ").append(line.timestamp).push_back('\n');
+        }
+
+        buffer.append(line.text).push_back('\n');
+    }
+
+    // Write a line to a file, the mutex must be locked.
+    void write(QFile& file, const HistoryLine& line)
+    {
+        format(m_buffer, line);
+
+        // A single write per line, so a crash loses at most the line being written.
+        file.write(m_buffer.data(), static_cast<qint64>(m_buffer.size()));
+        file.flush();
+    }
+
+    void compactIfNeeded()
+    {
+        if (m_lines <= m_maxSize * 2 || m_compaction.isRunning() || (m_shared && !m_lockFile.isOpen())) {
+            return;
+        }
+
+        // A shared journal is compacted from the content of the file, the lines of the other
+        // sessions included, so the lines are selected by the compaction.
+        std::vector<HistoryLine> lines = m_shared ? std::vector<HistoryLine>() : select(m_entries, m_maxSize, m_unique);
+
+        {
+            QMutexLocker lock(&m_mutex);
+            m_compacting = true;
+        }
+
+        auto promise = std::make_shared<QPromise<bool>>();
+        m_compaction = promise->future();
+
+        promise->start();
+
+        QThreadPool::globalInstance()->start(
+          [this, promise, lines = std::move(lines), maxSize = m_maxSize, unique = m_unique]() mutable {
+              // The compacted file is written without holding the mutex, appending goes on meanwhile.
+              QSaveFile   file(m_path);
+              QByteArray  head;
+              std::string buffer;
+              qint64      offset = 0;
+
+              if (m_shared) {
+                  {
+                      FileLock fileLock(m_lockFile, false);
+
+                      if (QFile journal(m_path); journal.open(QIODevice::ReadOnly)) {
+                          head   = journal.readLine(MAX_HEAD_SIZE);
+                          offset = journal.size();
+                          parse(journal, 0, lines);
+                      }
+                  }
+
+                  lines = select(lines, maxSize, unique);
+              }
+
+              bool saved = file.open(QIODevice::WriteOnly);
+
+              if (m_shared) {
+                  const auto marker = QByteArray::number(QDateTime::currentMSecsSinceEpoch());
+                  saved             = saved && file.write(QByteArray(MARKER_PREFIX.data()) + marker + '\n') >= 0;
+              }
+
+              for (const auto& line : lines) {
+                  format(buffer, line);
+                  saved = saved && file.write(buffer.data(), static_cast<qint64>(buffer.size())) >= 0;
+              }
+
+              // The lines appended meanwhile are written last, then the file replaces the journal.
+              QMutexLocker              lock(&m_mutex);
+              std::unique_ptr<FileLock> fileLock;
+
+              if (m_shared) {
+                  fileLock = std::make_unique<FileLock>(m_lockFile, true);
+
+                  // Another session may have compacted the journal in the meantime.
+                  if (QFile journal(m_path); journal.open(QIODevice::ReadOnly) && journal.size() >= offset
+                                             && journal.readLine(MAX_HEAD_SIZE) == head) {
+                      parse(journal, offset, m_appended);
+                  } else {
+                      saved = false;
+                  }
+              }
+
+              for (const auto& line : m_appended) {
+                  format(buffer, line);
+                  saved = saved && file.write(buffer.data(), static_cast<qint64>(buffer.size())) >= 0;
+              }
+
+              if (saved && file.commit()) {
+                  m_lines = lines.size() + m_appended.size();
+
+                  if (m_shared) {
+                      // Read the compacted file again, like the other sessions do.
+                      m_stale = true;
+                  } else {
+                      m_file.close();
+                      m_file.open(QIODevice::WriteOnly | QIODevice::Append);
+                  }
+              } else {
+                  saved = false;
+                  file.cancelWriting();
+              }
+
+              m_appended.clear();
+              m_compacting = false;
+
+              promise->addResult(saved);
+              promise->finish();
+          });
+    }
+
+    // Guards the files, the state of the reads and the lines appended while the file is compacted.
+    QMutex                   m_mutex;
+    QFile                    m_file;
+    QFile                    m_lockFile;
+    QString                  m_path;
+    QByteArray               m_head;
+    std::string              m_buffer;
+    std::vector<HistoryLine> m_appended;
+    std::atomic<size_t>      m_lines{ 0 };
+    qint64                   m_offset     = 0;
+    bool                     m_compacting = false;
+    bool                     m_stale      = false;
+
+    // Only accessed by the console thread.
+    std::deque<HistoryLine> m_entries;
+    QFuture<bool>           m_compaction;
+    size_t                  m_maxSize = 10000;
+    bool                    m_unique  = true;
+    bool                    m_shared  = false;
+};
+
+// History indexes the entries of the history for substring searches. Every entry is indexed
+// by the characters and the trigrams it contains, ignoring the case: the entries containing a
+// pattern are found among the ones listed for its rarest n-gram, from the newest to the oldest,
+// so a search only looks at a small part of the history. Removed entries, the duplicates of a
+// unique history and the ones over the maximum size, are only marked as such and the index is
+// rebuilt once they outnumber the others.
+class QConsole::History
+{
+public:
+    struct Entry
+    {
+        std::string text;
+        std::string timestamp;
+        quint64     number;
+        bool        removed;
+    };
+
+    // Add an entry to the history, evaluated at the specified time or now if it's empty.
+    void add(std::string_view text, std::string_view timestamp = std::string_view())
+    {
+        if (m_unique) {
+            if (const auto iter = m_ids.find(std::string(text)); iter != m_ids.end()) {
+                remove(iter->second);
+            }
+        }
+
+        const auto id = static_cast<uint32_t>(m_entries.size());
+
+        m_entries.push_back({ std::string(text), timestamp.empty() ? currentTimestamp() : std::string(timestamp),
+                              m_next++, false });
+        m_count++;
+
+        if (m_unique) {
+            m_ids[m_entries.back().text] = id;
+        }
+
+        index(id);
+
+        while (m_count > m_maxSize) {
+            while (m_entries[m_first].removed) {
+                m_first++;
+            }
+
+            remove(m_first);
+        }
+
+        if (m_entries.size() - m_count > std::max<size_t>(m_count, 1024)) {
+            rebuild();
+        }
+    }
+
+    void clear()
+    {
+        m_entries.clear();
+        m_postings.clear();
+        m_ids.clear();
+        m_first = 0;
+        m_count = 0;
+        m_next  = 0;
+    }
+
+    void setMaxSize(size_t size)
+    {
+        m_maxSize = std::max<size_t>(size, 1);
+    }
+
+    void setUnique(bool unique)
+    {
+        m_unique = unique;
+        rebuild();
+    }
+
+    // Return the number of entries.
+    size_t size() const
+    {
+        return m_count;
+    }
+
+    // Return the entries containing the pattern, all of them if it's empty, from the newest to
+    // the oldest. The first "skip" matches are skipped and at most "limit" entries are returned.
+    std::vector<const Entry*> search(std::string_view pattern, size_t skip, size_t limit) const
+    {
+        std::vector<const Entry*> result;
+
+        const auto accept = [&](uint32_t id) {
+            if (const auto& e = m_entries[id]; !e.removed && contains(e.text, pattern)) {
+                if (skip > 0) {
+                    skip--;
+                } else {
+                    result.push_back(&e);
+                }
+            }
+
+            return result.size() < limit;
+        };
+
+        if (limit == 0) {
+            return result;
+        }
+
+        if (pattern.empty()) {
+            for (auto id = m_entries.size(); id > m_first && accept(static_cast<uint32_t>(id - 1)); --id) {
+            }
+
+            return result;
+        }
+
+        // Look for the n-gram of the pattern that occurs in the fewest entries.
+        const size_t                 length = pattern.size() < 3 ? 1 : 3;
+        const std::vector<uint32_t>* rarest = nullptr;
+
+        for (size_t i = 0; i + length <= pattern.size(); ++i) {
+            const auto iter = m_postings.find(key(pattern.substr(i, length)));
+
+            if (iter == m_postings.end()) {
+                return result;
+            }
+
+            if (rarest == nullptr || iter->second.size() < rarest->size()) {
+                rarest = &iter->second;
+            }
+        }
+
+        for (auto iter = rarest->rbegin(); iter != rarest->rend() && accept(*iter); ++iter) {
+        }
+
+        return result;
+    }
+
+private:
+    // Return the key of an n-gram of at most 3 bytes, ignoring the case.
+    static uint32_t key(std::string_view gram)
+    {
+        uint32_t k = static_cast<uint32_t>(gram.size()) << 24;
+
+        for (size_t i = 0; i < gram.size(); ++i) {
+            k |= static_cast<uint32_t>(static_cast<unsigned char>(fold(gram[i]))) << (i * 8);
+        }
+
+        return k;
+    }
+
+    static bool contains(std::string_view text, std::string_view pattern)
+    {
+        return std::search(text.begin(), text.end(), pattern.begin(), pattern.end(),
+                           [](char a, char b) { return fold(a) == fold(b); })
+               != text.end();
+    }
+
+    void index(uint32_t id)
+    {
+        const std::string_view text = m_entries[id].text;
+
+        for (size_t i = 0; i < text.size(); ++i) {
+            for (const size_t length : { size_t(1), size_t(3) }) {
+                if (i + length > text.size()) {
+                    break;
+                }
+
+                // An entry is listed once per n-gram, and it's the last one listed so far.
+                if (auto& ids = m_postings[key(text.substr(i, length))]; ids.empty() || ids.back() != id) {
+                    ids.push_back(id);
+                }
+            }
+        }
+    }
+
+    void remove(size_t id)
+    {
+        auto& e = m_entries[id];
+
+        if (!e.removed) {
+            e.removed = true;
+            m_count--;
+
+            if (const auto iter = m_ids.find(e.text); iter != m_ids.end() && iter->second == id) {
+                m_ids.erase(iter);
+            }
+        }
+    }
+
+    // Drop the removed entries and index the others again.
+    void rebuild()
+    {
+        std::vector<Entry> entries;
+        entries.reserve(m_count);
+
+        for (auto i = m_first; i < m_entries.size(); ++i) {
+            if (!m_entries[i].removed) {
+                entries.push_back(std::move(m_entries[i]));
+            }
+        }
+
+        m_entries = std::move(entries);
+        m_postings.clear();
+        m_ids.clear();
+        m_first = 0;
+
+        for (uint32_t id = 0; id < m_entries.size(); ++id) {
+            if (m_unique) {
+                if (const auto iter = m_ids.find(m_entries[id].text); iter != m_ids.end()) {
+                    m_entries[iter->second].removed = true;
+                    m_count--;
+                }
+
+                m_ids[m_entries[id].text] = id;
+            }
+
+            index(id);
+        }
+    }
+
+    std::vector<Entry>                                  m_entries;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> m_postings;
+    std::unordered_map<std::string, uint32_t>           m_ids;
+    size_t                                              m_first   = 0;
+    size_t                                              m_count   = 0;
+    size_t                                              m_maxSize = 10000;
+    quint64                                             m_next    = 0;
+    bool                                                m_unique  = true;
+};
+
+// Output buffers the console output, coalescing the writes of the output streams into as few
+// as possible. It writes to the stdout file descriptor directly, or to the output device.
+class QConsole::Output : public QIODevice
+{
+public:
+    Output()
+    {
+        m_buffer.reserve(OUTPUT_BLOCK_SIZE);
+        m_timer.setSingleShot(true);
+        QObject::connect(&m_timer, &QTimer::timeout, this, [this]() { flush(); });
+        open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+    }
+
+    void setDevice(QIODevice* device)
+    {
+        flush();
+        m_device = device;
+    }
+
+    void setBuffering(Buffering buffering, int maxLatency)
+    {
+        flush();
+        m_buffering  = buffering;
+        m_maxLatency = std::max(maxLatency, 0);
+    }
+
+    // Return space for "size" bytes at the end of the buffer, to be filled in place and then
+    // given back with "commit".
+    char* reserve(size_t size)
+    {
+        const auto offset = m_buffer.size();
+        m_buffer.resize(offset + size);
+        return m_buffer.data() + offset;
+    }
+
+    // Keep the bytes of the reserved space preceding "end".
+    void commit(char* begin, const char* end)
+    {
+        const auto offset = static_cast<size_t>(begin - m_buffer.data());
+        m_buffer.resize(static_cast<size_t>(end - m_buffer.data()));
+        written(offset);
+    }
+
+    void append(const char* data, size_t size)
+    {
+        const auto offset = m_buffer.size();
+        m_buffer.append(data, size);
+        written(offset);
+    }
+
+    // Write the buffered output.
+    void flush()
+    {
+        m_timer.stop();
+
+        if (m_buffer.empty()) {
+            return;
+        }
+
+        if (m_device != nullptr) {
+            if (const auto n = m_device->write(m_buffer.data(), static_cast<qint64>(m_buffer.size())); n > 0) {
+                m_statistics.bytes += static_cast<quint64>(n);
+            }
+
+            m_statistics.syscalls++;
+        } else {
+            // Keep the order with what was written through the stdout stream of the C library.
+            fflush(stdout);
+
+            for (size_t offset = 0; offset < m_buffer.size();) {
+#ifdef Q_OS_WIN32
+                const auto n = _write(_fileno(stdout), m_buffer.data() + offset,
+                                      static_cast<unsigned int>(m_buffer.size() - offset));
+#else
+                const auto n = ::write(STDOUT_FILENO, m_buffer.data() + offset, m_buffer.size() - offset);
+#endif
+                m_statistics.syscalls++;
+
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+
+                // The rest is dropped when stdout is closed or broken.
+                if (n <= 0) {
+                    break;
+                }
+
+                offset += static_cast<size_t>(n);
+                m_statistics.bytes += static_cast<quint64>(n);
+            }
+        }
+
+        m_buffer.clear();
+    }
+
+    OutputStatistics statistics() const
+    {
+        return m_statistics;
+    }
+
+protected:
+    qint64 readData(char* data, qint64 size) override
+    {
+        Q_UNUSED(data);
+        Q_UNUSED(size);
+        return -1;
+    }
+
+    qint64 writeData(const char* data, qint64 size) override
+    {
+        append(data, static_cast<size_t>(size));
+        return size;
+    }
+
+private:
+    // Write the buffer according to the buffering, given the offset of the bytes just added.
+    void written(size_t offset)
+    {
+        if (m_buffer.size() >= OUTPUT_BLOCK_SIZE) {
+            flush();
+        } else if (m_buffering == Buffering::Line && m_buffer.find('\n', offset) != std::string::npos) {
+            flush();
+        } else if (!m_buffer.empty() && m_maxLatency > 0 && !m_timer.isActive()) {
+            m_timer.start(m_maxLatency);
+        }
+    }
+
+    std::string      m_buffer;
+    QIODevice*       m_device     = nullptr;
+    Buffering        m_buffering  = Buffering::Line;
+    int              m_maxLatency = 50;
+    QTimer           m_timer;
+    OutputStatistics m_statistics;
+};
+
+// Metrics records the invocations of the commands and HDR-style histograms of their latency:
+// values are counted in buckets that get wider as the values grow, so a histogram has a fixed
+// size and the percentiles it gives are within 1/32 of the exact values.
+class QConsole::Metrics
+{
+public:
+    // The number of buckets of the values below 64, then of each power of two is half of it.
+    static constexpr int SUB_BUCKET_BITS = 6;
+    static constexpr int SUB_BUCKETS     = 1 << SUB_BUCKET_BITS;
+    static constexpr int HALF_BUCKETS    = SUB_BUCKETS / 2;
+
+    // Latencies are recorded in nanoseconds, up to 2^40 (about 18 minutes).
+    static constexpr int    MAX_BITS = 40;
+    static constexpr qint64 MAX      = (qint64(1) << MAX_BITS) - 1;
+    static constexpr size_t BUCKETS  = (MAX_BITS - SUB_BUCKET_BITS) * HALF_BUCKETS + SUB_BUCKETS;
+
+    void record(std::string_view name, qint64 latency, bool failed)
+    {
+        latency = std::clamp<qint64>(latency, 0, MAX);
+
+        QMutexLocker lock(&m_mutex);
+        auto&        entry = m_entries[std::string(name)];
+
+        if (!entry.counts) {
+            entry.counts = std::make_unique<quint32[]>(BUCKETS);
+            entry.min    = latency;
+        }
+
+        entry.invocations++;
+        entry.errors += failed ? 1 : 0;
+        entry.sum += latency;
+        entry.min = std::min(entry.min, latency);
+        entry.max = std::max(entry.max, latency);
+        entry.counts[bucket(latency)]++;
+    }
+
+    QList<CommandMetrics> snapshot() const
+    {
+        QList<CommandMetrics> metrics;
+        QMutexLocker          lock(&m_mutex);
+
+        metrics.reserve(static_cast<qsizetype>(m_entries.size()));
+
+        for (const auto& [name, entry] : m_entries) {
+            CommandMetrics m;
+            m.name        = toQString(name);
+            m.invocations = entry.invocations;
+            m.errors      = entry.errors;
+            m.min         = entry.min;
+            m.mean        = entry.sum / static_cast<qint64>(entry.invocations);
+            m.p50         = percentile(entry, 0.5);
+            m.p90         = percentile(entry, 0.9);
+            m.p99         = percentile(entry, 0.99);
+            m.p999        = percentile(entry, 0.999);
+            m.max         = entry.max;
+            metrics.append(std::move(m));
+        }
+
+        lock.unlock();
+
+        std::sort(metrics.begin(), metrics.end(), [](const CommandMetrics& a, const CommandMetrics& b) {
+            return a.invocations != b.invocations ? a.invocations > b.invocations : a.name < b.name;
+        });
+
+        return metrics;
+    }
+
+    void reset()
+    {
+        QMutexLocker lock(&m_mutex);
+        m_entries.clear();
+    }
+
+private:
+    struct Entry
+    {
+        quint64                    invocations = 0;
+        quint64                    errors      = 0;
+        qint64                     sum         = 0;
+        qint64                     min         = 0;
+        qint64                     max         = 0;
+        std::unique_ptr<quint32[]> counts;
+    };
+
+    // Return the bucket of a value: the values below 64 have their own, then the values with
+    // their highest bit at position n are split into 32 buckets of 2^(n - 5) values.
+    static size_t bucket(qint64 value)
+    {
+        const auto v = static_cast<quint64>(value);
+
+        if (v < SUB_BUCKETS) {
+            return static_cast<size_t>(v);
+        }
+
+        const auto shift = (63 - qCountLeadingZeroBits(v)) - SUB_BUCKET_BITS + 1;
+        return static_cast<size_t>(shift * HALF_BUCKETS) + static_cast<size_t>(v >> shift);
+    }
+
+    // Return the highest value counted in a bucket.
+    static qint64 highest(size_t bucket)
+    {
+        if (bucket < SUB_BUCKETS) {
+            return static_cast<qint64>(bucket);
+        }
+
+        const auto shift = bucket / HALF_BUCKETS - 1;
+        const auto sub   = bucket % HALF_BUCKETS + HALF_BUCKETS;
+        return static_cast<qint64>(((sub + 1) << shift) - 1);
+    }
+
+    static qint64 percentile(const Entry& entry, double quantile)
+    {
+        const auto target = std::max<quint64>(1, static_cast<quint64>(std::ceil(quantile * entry.invocations)));
+        quint64    count  = 0;
+
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            if (count += entry.counts[i]; count >= target) {
+                return std::min(highest(i), entry.max);
+            }
+        }
+
+        return entry.max;
+    }
+
+    mutable QMutex                         m_mutex;
+    std::unordered_map<std::string, Entry> m_entries;
+};
+
+// Tracer records spans of time, like the run of a callback or of a command, to export them in
+// the Chrome trace event format. Each thread writes the spans it ends to its own ring buffer
+// without locking, keeping the latest ones. A disabled tracer costs a relaxed atomic load per span.
+class QConsole::Tracer
+{
+public:
+    // The number of spans kept by each thread.
+    static constexpr size_t CAPACITY = 8192;
+
+    // Span records the time from its construction to its destruction, if tracing is enabled.
+    class Span
+    {
+    public:
+        Span(Tracer& tracer, const char* name, std::string_view detail)
+          : m_tracer(tracer.enabled() ? &tracer : nullptr)
+          , m_name(name)
+          , m_detail(detail)
+          , m_begin(m_tracer != nullptr ? now() : 0)
+        {
+        }
+
+        ~Span()
+        {
+            if (m_tracer != nullptr) {
+                m_tracer->record(m_name, m_begin, now(), m_detail);
+            }
+        }
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+    private:
+        Tracer*          m_tracer;
+        const char*      m_name;
+        std::string_view m_detail;
+        qint64           m_begin;
+    };
+
+    Tracer()
+      : m_id(++s_instances)
+      , m_enabled(false)
+    {
+    }
+
+    // Return the time in nanoseconds, from a monotonic clock.
+    static qint64 now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now().time_since_epoch())
+          .count();
+    }
+
+    bool enabled() const
+    {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    void setEnabled(bool enabled)
+    {
+        m_enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    // Return a span with the given name, which must be a string literal. The detail is copied,
+    // truncated to 39 bytes.
+    Span span(const char* name, std::string_view detail = std::string_view())
+    {
+        return Span(*this, name, detail);
+    }
+
+    void record(const char* name, qint64 begin, qint64 end, std::string_view detail)
+    {
+        auto&      ring  = local();
+        const auto head  = ring.head.load(std::memory_order_relaxed);
+        auto&      slot  = ring.slots[head % CAPACITY];
+        auto&      event = slot.event;
+        const auto size  = std::min(detail.size(), sizeof(event.detail) - 1);
+
+        // The slot is marked as being written, so a reader copying it meanwhile drops the copy.
+        slot.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        event.name     = name;
+        event.begin    = begin;
+        event.duration = end - begin;
+        std::memcpy(event.detail, detail.data(), size);
+        event.detail[size] = '\0';
+
+        slot.sequence.store(head + 1, std::memory_order_release);
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+
+    // Forget the spans recorded so far.
+    void clear()
+    {
+        QMutexLocker lock(&m_mutex);
+
+        for (const auto& ring : m_rings) {
+            ring->floor.store(ring->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+        }
+    }
+
+    // Return the spans as a Chrome trace event document, with a track per thread.
+    QByteArray json() const
+    {
+        const auto         pid = QCoreApplication::applicationPid();
+        QJsonArray         events;
+        std::vector<Event> copy;
+        QMutexLocker       lock(&m_mutex);
+
+        for (size_t tid = 0; tid < m_rings.size(); ++tid) {
+            const auto& ring = *m_rings[tid];
+
+            events.append(QJsonObject{
+              { "name", "thread_name" },
+              { "ph", "M" },
+              { "pid", pid },
+              { "tid", static_cast<qint64>(tid + 1) },
+              { "args", QJsonObject{ { "name", ring.name } } },
+            });
+
+            const auto head  = ring.head.load(std::memory_order_acquire);
+            const auto first = std::max<quint64>(ring.floor.load(std::memory_order_relaxed),
+                                                 head > CAPACITY ? head - CAPACITY : 0);
+
+            copy.clear();
+
+            // A span overwritten while it's copied is left out: the sequence of its slot changed.
+            for (auto i = first; i < head; ++i) {
+                const auto& slot = ring.slots[i % CAPACITY];
+
+                if (slot.sequence.load(std::memory_order_acquire) != i + 1) {
+                    continue;
+                }
+
+                const auto event = slot.event;
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (slot.sequence.load(std::memory_order_relaxed) == i + 1) {
+                    copy.push_back(event);
+                }
+            }
+
+            for (const auto& event : copy) {
+                QJsonObject object{
+                  { "name", event.name },
+                  { "cat", "qconsole" },
+                  { "ph", "X" },
+                  { "ts", static_cast<double>(event.begin) / 1000 },
+                  { "dur", static_cast<double>(event.duration) / 1000 },
+                  { "pid", pid },
+                  { "tid", static_cast<qint64>(tid + 1) },
+                };
+
+                if (event.detail[0] != '\0') {
+                    object.insert("args", QJsonObject{ { "detail", QString::fromUtf8(event.detail) } });
+                }
+
+                events.append(object);
+            }
+        }
+
+        return QJsonDocument(QJsonObject{ { "traceEvents", events }, { "displayTimeUnit", "ns" } })
+          .toJson(QJsonDocument::Compact);
+    }
+
+private:
+    struct Event
+    {
+        const char* name;
+        qint64      begin;
+        qint64      duration;
+        char        detail[40];
+    };
+
+    // Slot holds a span and the index it was recorded at plus one, or 0 while it's written.
+    struct Slot
+    {
+        std::atomic<quint64> sequence{ 0 };
+        Event                event;
+    };
+
+    struct Ring
+    {
+        std::atomic<quint64>    head{ 0 };
+        std::atomic<quint64>    floor{ 0 };
+        Qt::HANDLE              thread;
+        QString                 name;
+        std::unique_ptr<Slot[]> slots;
+    };
+
+    // Return the ring buffer of the current thread, created on its first span.
+    Ring& local()
+    {
+        // Each thread remembers the ring of the last tracer it wrote to.
+        thread_local quint64 owner  = 0;
+        thread_local Ring*   cached = nullptr;
+
+        if (owner == m_id) {
+            return *cached;
+        }
+
+        QMutexLocker lock(&m_mutex);
+
+        const auto thread = QThread::currentThreadId();
+        const auto iter   = std::find_if(m_rings.begin(), m_rings.end(),
+                                         [thread](const std::unique_ptr<Ring>& ring) { return ring->thread == thread; });
+
+        if (iter != m_rings.end()) {
+            cached = iter->get();
+        } else {
+            auto ring    = std::make_unique<Ring>();
+            ring->thread = thread;
+            ring->name   = QThread::currentThread()->objectName();
+            ring->slots  = std::make_unique<Slot[]>(CAPACITY);
+
+            if (ring->name.isEmpty()) {
+                ring->name = QStringLiteral("Thread %1").arg(m_rings.size() + 1);
+            }
+
+            cached = ring.get();
+            m_rings.push_back(std::move(ring));
+        }
+
+        owner = m_id;
+        return *cached;
+    }
+
+    static inline std::atomic<quint64> s_instances{ 0 };
+
+    const quint64                      m_id;
+    std::atomic<bool>                  m_enabled;
+    mutable QMutex                     m_mutex;
+    std::vector<std::unique_ptr<Ring>> m_rings;
+};
+
+// Pager shows the output of a command a screen at a time on the alternate screen of the
+// terminal, like "less". Lines are asked for to the producer as they're scrolled to, then kept
+// to scroll back. It reads the keys itself, so it may only run while the line editor is idle.
+class QConsole::Pager
+{
+public:
+    Pager(const Producer& producer, Output& output)
+      : m_producer(producer)
+      , m_output(output)
+      , m_top(0)
+      , m_rows(0)
+      , m_columns(0)
+      , m_ended(false)
+    {
+        resize();
+    }
+
+    // Show the output until the user quits. An output fitting on the screen is written as it is.
+    void run()
+    {
+        if (!fetch(m_rows + 1)) {
+            for (const auto& line : m_lines) {
+                m_output.append(line.data(), line.size());
+                m_output.append("\n", 1);
+            }
+
+            return;
+        }
+
+        [[maybe_unused]] RawMode raw;
+        write("\33[?1049h\33[?25l");
+        render();
+
+        for (auto quit = false; !quit;) {
+            m_message.clear();
+
+            switch (const auto key = readKey()) {
+            case 'q':
+            case 'Q':
+            case Key::Quit:
+                quit = true;
+                break;
+            case 'j':
+            case '\r':
+            case '\n':
+            case Key::Down:
+                scroll(1);
+                break;
+            case 'k':
+            case Key::Up:
+                scroll(-1);
+                break;
+            case ' ':
+            case 'f':
+            case Key::PageDown:
+                scroll(static_cast<qint64>(m_rows));
+                break;
+            case 'b':
+            case Key::PageUp:
+                scroll(-static_cast<qint64>(m_rows));
+                break;
+            case 'g':
+            case Key::Home:
+                m_top = 0;
+                break;
+            case 'G':
+            case Key::End:
+                while (fetch(m_lines.size() + 1)) {
+                }
+
+                m_top = bottom();
+                break;
+            case '/':
+                if (readPattern()) {
+                    search(true, m_top);
+                }
+                break;
+            case 'n':
+            case 'N':
+                if (m_pattern.empty()) {
+                    m_message = "No previous pattern";
+                } else {
+                    search(key == 'n', key == 'n' ? m_top + 1 : m_top);
+                }
+                break;
+            case Key::Resize:
+                resize();
+                m_top = std::min(m_top, bottom());
+                break;
+            default:
+                continue;
+            }
+
+            if (!quit) {
+                render();
+            }
+        }
+
+        write("\33[?25h\33[?1049l");
+    }
+
+private:
+    enum Key
+    {
+        Escape   = 0x1b,
+        Up       = 0x100,
+        Down     = 0x101,
+        PageUp   = 0x102,
+        PageDown = 0x103,
+        Home     = 0x104,
+        End      = 0x105,
+        Resize   = 0x106,
+        Quit     = 0x107
+    };
+
+    // RawMode reads the keys as they're pressed, without echoing them and with Ctrl+C read as a
+    // key, until it's destroyed.
+    class RawMode
+    {
+    public:
+#ifdef Q_OS_WIN32
+        // The keys are read with "_getch", which doesn't wait for a line nor echo them.
+        RawMode() = default;
+#else
+        RawMode()
+        {
+            tcgetattr(STDIN_FILENO, &m_saved);
+
+            auto raw = m_saved;
+            raw.c_lflag &= ~static_cast<tcflag_t>(ICANON | ECHO | ISIG);
+            raw.c_cc[VMIN]  = 1;
+            raw.c_cc[VTIME] = 0;
+            tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+        }
+
+        ~RawMode()
+        {
+            tcsetattr(STDIN_FILENO, TCSANOW, &m_saved);
+        }
+
+    private:
+        termios m_saved;
+#endif
+    };
+
+    // Ask the producer for lines until there are the given number of them. Return false if the
+    // output ended before.
+    bool fetch(size_t count)
+    {
+        std::string line;
+
+        while (m_lines.size() < count && !m_ended) {
+            line.clear();
+
+            if (m_producer(line)) {
+                m_lines.push_back(std::move(line));
+            } else {
+                m_ended = true;
+            }
+        }
+
+        return m_lines.size() >= count;
+    }
+
+    // Return the first line shown when scrolled to the bottom, as far as lines were fetched.
+    size_t bottom() const
+    {
+        return m_lines.size() > m_rows ? m_lines.size() - m_rows : 0;
+    }
+
+    void scroll(qint64 delta)
+    {
+        if (delta < 0) {
+            m_top -= std::min(m_top, static_cast<size_t>(-delta));
+        } else {
+            fetch(m_top + static_cast<size_t>(delta) + m_rows);
+            m_top = std::min(m_top + static_cast<size_t>(delta), bottom());
+        }
+    }
+
+    // Scroll to the next or the previous line matching the pattern, starting from the given line.
+    void search(bool forward, size_t from)
+    {
+        if (forward) {
+            for (auto i = from; i < m_lines.size() || fetch(i + 1); ++i) {
+                if (matches(m_lines[i])) {
+                    m_top = i;
+                    scroll(0);
+                    return;
+                }
+            }
+        } else {
+            for (auto i = std::min(from, m_lines.size()); i-- > 0;) {
+                if (matches(m_lines[i])) {
+                    m_top = i;
+                    return;
+                }
+            }
+        }
+
+        m_message = "Pattern not found";
+    }
+
+    // Return the position of the next match of the pattern in the text, ignoring the case.
+    std::string_view::size_type find(std::string_view text, std::string_view::size_type position) const
+    {
+        const auto iter = std::search(text.begin() + static_cast<std::ptrdiff_t>(position), text.end(),
+                                      m_pattern.begin(), m_pattern.end(),
+                                      [](char a, char b) { return fold(a) == fold(b); });
+
+        return iter == text.end() ? std::string_view::npos : static_cast<size_t>(iter - text.begin());
+    }
+
+    // Copy the line without its escape sequences, along with the offset in the line of every
+    // byte of the copy.
+    void strip(std::string_view line)
+    {
+        m_plain.clear();
+        m_offsets.clear();
+
+        for (size_t i = 0; i < line.size(); ++i) {
+            if (line[i] == '\33' && i + 1 < line.size() && line[i + 1] == '[') {
+                for (i += 2; i < line.size() && (line[i] < 0x40 || line[i] > 0x7e); ++i) {
+                }
+            } else {
+                m_plain.push_back(line[i]);
+                m_offsets.push_back(i);
+            }
+        }
+    }
+
+    // Check if the line matches the pattern, leaving its escape sequences out.
+    bool matches(std::string_view line)
+    {
+        strip(line);
+        return find(m_plain, 0) != std::string_view::npos;
+    }
+
+    // Read the pattern typed on the status line. Return false if it was canceled.
+    bool readPattern()
+    {
+        std::string pattern;
+
+        for (;;) {
+            m_frame.assign("\33[").append(std::to_string(m_rows + 1)).append(";1H\33[K/").append(pattern);
+            write(m_frame);
+
+            const auto key = readKey();
+
+            if (key == '\r' || key == '\n') {
+                break;
+            }
+
+            if (key == Key::Escape || key == Key::Quit) {
+                return false;
+            }
+
+            if (key == 0x7f || key == '\b') {
+                // Remove the continuation bytes of the last character along with it.
+                while (!pattern.empty() && (pattern.back() & 0xc0) == 0x80) {
+                    pattern.pop_back();
+                }
+
+                if (!pattern.empty()) {
+                    pattern.pop_back();
+                }
+            } else if (key >= 0x20 && key < 0x100 && key != 0x7f) {
+                pattern.push_back(static_cast<char>(key));
+            }
+        }
+
+        if (!pattern.empty()) {
+            m_pattern = std::move(pattern);
+        }
+
+        return !m_pattern.empty();
+    }
+
+    // Draw the visible lines and the status line in a single write.
+    void render()
+    {
+        fetch(m_top + m_rows);
+        m_frame.assign("\33[H");
+
+        for (size_t row = 0; row < m_rows; ++row) {
+            if (const auto i = m_top + row; i < m_lines.size()) {
+                appendLine(m_lines[i]);
+            } else {
+                m_frame.push_back('~');
+            }
+
+            m_frame.append("\33[0m\33[K\n");
+        }
+
+        m_frame.append("\33[7m");
+
+        if (!m_message.empty()) {
+            m_frame.append(m_message);
+        } else if (m_ended && m_top + m_rows >= m_lines.size()) {
+            m_frame.append("(END)");
+        } else {
+            m_frame.append("lines ").append(std::to_string(m_top + 1)).append("-").append(std::to_string(m_top + m_rows));
+        }
+
+        m_frame.append("\33[0m\33[K");
+        write(m_frame);
+    }
+
+    // Append the part of the line fitting on the screen, highlighting the matches of the pattern.
+    void appendLine(std::string_view line)
+    {
+        size_t end     = 0;
+        int    columns = 0;
+
+        // Escape sequences, like colors, take no room.
+        while (end < line.size()) {
+            if (line[end] == '\33' && end + 1 < line.size() && line[end + 1] == '[') {
+                for (end += 2; end < line.size() && (line[end] < 0x40 || line[end] > 0x7e); ++end) {
+                }
+
+                end++;
+            } else if ((line[end] & 0xc0) != 0x80 && ++columns > m_columns) {
+                break;
+            } else {
+                end++;
+            }
+        }
+
+        line = line.substr(0, std::min(end, line.size()));
+
+        if (m_pattern.empty()) {
+            m_frame.append(line);
+            return;
+        }
+
+        // The matches are found in the text without its escape sequences, then the bytes of the
+        // text are highlighted in the line, around the escape sequences.
+        strip(line);
+        m_marks.assign(m_plain.size(), false);
+
+        for (size_t i = 0; (i = find(m_plain, i)) != std::string_view::npos; i += m_pattern.size()) {
+            std::fill_n(m_marks.begin() + static_cast<std::ptrdiff_t>(i), m_pattern.size(), true);
+        }
+
+        size_t position    = 0;
+        bool   highlighted = false;
+
+        for (size_t i = 0; i <= m_plain.size(); ++i) {
+            const auto marked = i < m_plain.size() && m_marks[i];
+
+            if (marked != highlighted) {
+                const auto offset = i < m_plain.size() ? m_offsets[i] : m_offsets[i - 1] + 1;
+
+                m_frame.append(line.substr(position, offset - position)).append(marked ? "\33[7m" : "\33[27m");
+                position    = offset;
+                highlighted = marked;
+            }
+        }
+
+        m_frame.append(line.substr(position));
+    }
+
+    void resize()
+    {
+        int rows    = 24;
+        int columns = 80;
+
+#ifdef Q_OS_WIN32
+        CONSOLE_SCREEN_BUFFER_INFO info;
+
+        if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) {
+            rows    = info.srWindow.Bottom - info.srWindow.Top + 1;
+            columns = info.srWindow.Right - info.srWindow.Left + 1;
+        }
+#else
+        winsize size;
+
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0 && size.ws_col > 0) {
+            rows    = size.ws_row;
+            columns = size.ws_col;
+        }
+#endif
+
+        // The last row shows the status.
+        m_rows    = static_cast<size_t>(std::max(rows - 1, 1));
+        m_columns = std::max(columns, 1);
+    }
+
+    void write(std::string_view data)
+    {
+        m_output.append(data.data(), data.size());
+        m_output.flush();
+    }
+
+#ifdef Q_OS_WIN32
+    int readKey()
+    {
+        const auto c = _getch();
+
+        if (c != 0 && c != 0xe0) {
+            return c == 3 ? Key::Quit : c;
+        }
+
+        switch (_getch()) {
+        case 72:
+            return Key::Up;
+        case 80:
+            return Key::Down;
+        case 73:
+            return Key::PageUp;
+        case 81:
+            return Key::PageDown;
+        case 71:
+            return Key::Home;
+        case 79:
+            return Key::End;
+        default:
+            return 0;
+        }
+    }
+#else
+    // Read a byte, waiting no longer than the timeout in milliseconds if it isn't negative.
+    static int readByte(int timeout)
+    {
+        if (pollfd fd{ STDIN_FILENO, POLLIN, 0 }; timeout >= 0 && poll(&fd, 1, timeout) <= 0) {
+            return -1;
+        }
+
+        unsigned char c;
+
+        if (const auto n = ::read(STDIN_FILENO, &c, 1); n < 0 && errno == EINTR) {
+            // The terminal was resized, which interrupts the read.
+            return Key::Resize;
+        } else if (n <= 0) {
+            return Key::Quit;
+        }
+
+        return c;
+    }
+
+    int readKey()
+    {
+        if (const auto c = readByte(-1); c != Key::Escape) {
+            // Ctrl+C quits, since signals are disabled.
+            return c == 3 ? Key::Quit : c;
+        }
+
+        // Arrows and the other special keys are escape sequences, like "\33[A" or "\33[5~".
+        const auto introducer = readByte(25);
+
+        if (introducer != '[' && introducer != 'O') {
+            return Key::Escape;
+        }
+
+        switch (const auto c = readByte(25)) {
+        case 'A':
+            return Key::Up;
+        case 'B':
+            return Key::Down;
+        case 'H':
+            return Key::Home;
+        case 'F':
+            return Key::End;
+        case '1':
+        case '4':
+        case '5':
+        case '6':
+        case '7':
+        case '8':
+            if (readByte(25) != '~') {
+                return 0;
+            }
+
+            return c == '1' || c == '7' ? Key::Home
+                 : c == '4' || c == '8' ? Key::End
+                 : c == '5'             ? Key::PageUp
+                                        : Key::PageDown;
+        default:
+            return 0;
+        }
+    }
+#endif
+
+    const Producer&         m_producer;
+    Output&                 m_output;
+    std::deque<std::string> m_lines;
+    std::string             m_pattern;
+    std::string             m_message;
+    std::string             m_frame;
+    std::string             m_plain;
+    std::vector<size_t>     m_offsets;
+    std::vector<bool>       m_marks;
+    size_t                  m_top;
+    size_t                  m_rows;
+    int                     m_columns;
+    bool                    m_ended;
+};
+
+// Server accepts the remote sessions on a local socket. Only the user running the process can
+// connect. The sessions are served on the thread the console lives in, driven by the signals of
+// their sockets: an idle session costs neither a thread nor a timer. Their lines are evaluated
+// one at a time, a line entered while another one is being evaluated waits for it to finish.
+class QConsole::Server : public QObject
+{
+public:
+    explicit Server(QConsole* console)
+      : m_console(console)
+    {
+        m_server.setSocketOptions(QLocalServer::UserAccessOption);
+        connect(&m_server, &QLocalServer::newConnection, this, [this]() { accept(); });
+    }
+
+    ~Server();
+
+    // Listen on the socket, replacing the one left behind by a process that's gone.
+    bool listen(const QString& name)
+    {
+        m_server.close();
+
+        if (m_server.listen(name)) {
+            return true;
+        }
+
+        if (m_server.serverError() != QAbstractSocket::AddressInUseError) {
+            return false;
+        }
+
+        QLocalSocket probe;
+        probe.connectToServer(name);
+
+        if (probe.waitForConnected(100)) {
+            return false;
+        }
+
+        QLocalServer::removeServer(name);
+        return m_server.listen(name);
+    }
+
+    // Stop accepting sessions and close the ones connected.
+    void close();
+
+    // Return the number of sessions connected.
+    int count() const
+    {
+        return static_cast<int>(m_sessions.size());
+    }
+
+    // Return the session whose line is being evaluated, or nullptr.
+    Session* current() const
+    {
+        return m_current;
+    }
+
+    // Check if a line can be evaluated now.
+    bool idle() const
+    {
+        return m_current == nullptr && m_console->m_depth == 0;
+    }
+
+    // Evaluate a line of a session, the console output going to the session meanwhile.
+    void evaluate(Session& session, std::string_view line);
+
+    // Go on with the sessions that were waiting for the console to be idle.
+    void resume();
+
+private:
+    void accept();
+    void remove(Session* session);
+
+    QConsole*             m_console;
+    QLocalServer          m_server;
+    std::vector<Session*> m_sessions;
+    Session*              m_current = nullptr;
+};
+
+// Session is a remote console session. It edits the line itself, with hints, highlighting,
+// completion of the command names and its own history, so the client only has to put its
+// terminal in raw mode. The keys are handled as they arrive and the line is redrawn once per
+// batch of keys. The session is also the device its output is written to: the output is
+// buffered until a line has been evaluated, and the newlines are translated for a raw terminal.
+class QConsole::Session : public QIODevice
+{
+public:
+    Session(QConsole* console, QLocalSocket* socket)
+      : m_console(console)
+      , m_socket(socket)
+      , m_prompt(console->m_defaultPrompt)
+    {
+        socket->setParent(this);
+        open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+
+        m_output.setDevice(this);
+        m_output.setBuffering(Buffering::Manual, 0);
+        m_stream.setDevice(&m_output);
+
+        connect(socket, &QLocalSocket::readyRead, this, [this]() {
+            m_input.append(m_socket->readAll().toStdString());
+            process();
+        });
+
+        redraw(true);
+    }
+
+    QLocalSocket* socket() const
+    {
+        return m_socket;
+    }
+
+    Output& output()
+    {
+        return m_output;
+    }
+
+    // Return the stream the commands evaluated for the session write to.
+    QTextStream& stream()
+    {
+        return m_stream;
+    }
+
+    void setPrompt(std::string prompt)
+    {
+        m_prompt = std::move(prompt);
+    }
+
+    const std::string& prompt() const
+    {
+        return m_prompt;
+    }
+
+    // Read a line for the command being evaluated, echoing it unless it's hidden. The event loop
+    // runs while the keys are waited for, the other sessions wait for the command to finish.
+    // Return an empty array if the client is gone.
+    QByteArray readLine(std::string_view prompt, bool echo)
+    {
+        m_stream.flush();
+        m_output.flush();
+        send(prompt);
+
+        std::string line;
+        QEventLoop  loop;
+
+        connect(m_socket, &QLocalSocket::readyRead, &loop, &QEventLoop::quit);
+        connect(m_socket, &QLocalSocket::disconnected, &loop, &QEventLoop::quit);
+
+        for (;;) {
+            size_t i = 0;
+
+            for (; i < m_input.size(); ++i) {
+                const auto key = static_cast<unsigned char>(m_input[i]);
+
+                if (key == '\n' && std::exchange(m_return, false)) {
+                    continue;
+                }
+
+                m_return = key == '\r';
+
+                if (key == '\r' || key == '\n') {
+                    m_input.erase(0, i + 1);
+                    send("\r\n");
+                    return QByteArray::fromStdString(line);
+                }
+
+                if ((key == 0x7f || key == 0x08) && !line.empty()) {
+                    // Remove the last character, with its continuation bytes.
+                    while (!line.empty() && (static_cast<unsigned char>(line.back()) & 0xc0) == 0x80) {
+                        line.pop_back();
+                    }
+
+                    line.pop_back();
+                    send(echo ? "\b \b" : "");
+                } else if (key >= 0x20 && key != 0x7f) {
+                    line.push_back(static_cast<char>(key));
+                    send(echo ? std::string_view(&m_input[i], 1) : std::string_view());
+                }
+            }
+
+            m_input.clear();
+
+            if (m_socket->state() != QLocalSocket::ConnectedState) {
+                return QByteArray();
+            }
+
+            loop.exec();
+        }
+    }
+
+    // Close the session once the line being evaluated is done.
+    void hangUp()
+    {
+        m_closing = true;
+    }
+
+    // Handle the keys received so far. The keys following a line wait while it can't be evaluated.
+    void process()
+    {
+        // Keys arriving while a line of this session is evaluated are handled after it.
+        if (m_processing) {
+            return;
+        }
+
+        m_processing = true;
+
+        auto   dirty = false;
+        size_t i     = 0;
+
+        while (i < m_input.size() && !m_closing) {
+            const auto key = static_cast<unsigned char>(m_input[i]);
+
+            if (key == '\r' || key == '\n') {
+                // Clients send "\r\n" or either of them for a single Enter.
+                if (key == '\n' && m_return) {
+                    m_return = false;
+                    i++;
+                    continue;
+                }
+
+                if (!m_console->m_server->idle()) {
+                    m_deferred = true;
+                    break;
+                }
+
+                m_return = key == '\r';
+                m_input.erase(0, i + 1);
+                i      = 0;
+                dirty  = false;
+                enter();
+                continue;
+            }
+
+            m_return = false;
+
+            if (key == '\33') {
+                const auto length = escape(i);
+
+                if (length == 0) {
+                    break;
+                }
+
+                i += length;
+            } else {
+                control(key);
+                i++;
+            }
+
+            dirty = true;
+        }
+
+        m_input.erase(0, i);
+        m_processing = false;
+
+        if (m_closing) {
+            m_socket->disconnectFromServer();
+        } else if (dirty) {
+            redraw(true);
+        }
+    }
+
+    // Check if a line is waiting for the console to be idle, and forget it.
+    bool deferred()
+    {
+        return std::exchange(m_deferred, false);
+    }
+
+protected:
+    qint64 readData(char* data, qint64 size) override
+    {
+        Q_UNUSED(data);
+        Q_UNUSED(size);
+        return -1;
+    }
+
+    qint64 writeData(const char* data, qint64 size) override
+    {
+        std::string translated;
+        translated.reserve(static_cast<size_t>(size) + static_cast<size_t>(size) / 16);
+
+        for (qint64 i = 0; i < size; ++i) {
+            if (data[i] == '\n') {
+                translated += '\r';
+            }
+
+            translated += data[i];
+        }
+
+        send(translated);
+        return size;
+    }
+
+private:
+    // The number of lines kept in the history of a session.
+    static constexpr size_t MAX_HISTORY = 1000;
+
+    // Write to the client, if it's still there.
+    void send(std::string_view data)
+    {
+        if (m_socket->state() == QLocalSocket::ConnectedState) {
+            m_socket->write(data.data(), static_cast<qint64>(data.size()));
+        }
+    }
+
+    // Evaluate the line being edited.
+    void enter()
+    {
+        redraw(false);
+        send("\r\n");
+
+        auto line = std::string_view(m_line);
+
+        while (!line.empty() && isBlank(line.front())) {
+            line.remove_prefix(1);
+        }
+
+        while (!line.empty() && isBlank(line.back())) {
+            line.remove_suffix(1);
+        }
+
+        if (!line.empty()) {
+            if (m_history.empty() || m_history.back() != line) {
+                if (m_history.size() == MAX_HISTORY) {
+                    m_history.pop_front();
+                }
+
+                m_history.emplace_back(line);
+            }
+
+            m_console->m_server->evaluate(*this, line);
+        }
+
+        m_line.clear();
+        m_position = 0;
+        m_index    = m_history.size();
+
+        if (!m_closing) {
+            redraw(true);
+        }
+    }
+
+    // Handle a key that isn't part of an escape sequence.
+    void control(unsigned char key)
+    {
+        switch (key) {
+        case 0x01: // Ctrl-A
+            m_position = 0;
+            break;
+        case 0x02: // Ctrl-B
+            left();
+            break;
+        case 0x03: // Ctrl-C
+            redraw(false);
+            send("^C\r\n");
+            m_line.clear();
+            m_position = 0;
+            m_index    = m_history.size();
+            break;
+        case 0x04: // Ctrl-D
+            if (m_line.empty()) {
+                send("\r\n");
+                m_closing = true;
+            } else {
+                erase(m_position, next(m_position));
+            }
+            break;
+        case 0x05: // Ctrl-E
+            m_position = m_line.size();
+            break;
+        case 0x06: // Ctrl-F
+            m_position = next(m_position);
+            break;
+        case 0x08: // Ctrl-H
+        case 0x7f: // Backspace
+            erase(previous(m_position), m_position);
+            break;
+        case 0x09: // Tab
+            complete();
+            break;
+        case 0x0b: // Ctrl-K
+            erase(m_position, m_line.size());
+            break;
+        case 0x0c: // Ctrl-L
+            send("\33[H\33[2J");
+            break;
+        case 0x0e: // Ctrl-N
+            navigate(+1);
+            break;
+        case 0x10: // Ctrl-P
+            navigate(-1);
+            break;
+        case 0x15: // Ctrl-U
+            erase(0, m_position);
+            break;
+        case 0x17: { // Ctrl-W
+            auto start = m_position;
+
+            while (start > 0 && isBlank(m_line[start - 1])) {
+                start--;
+            }
+
+            while (start > 0 && !isBlank(m_line[start - 1])) {
+                start--;
+            }
+
+            erase(start, m_position);
+            break;
+        }
+        default:
+            // The other control characters are ignored, the bytes of UTF-8 sequences are inserted.
+            if (key >= 0x20) {
+                m_line.insert(m_position++, 1, static_cast<char>(key));
+            }
+        }
+    }
+
+    // Handle the escape sequence at the offset and return its length, or 0 if it's incomplete.
+    size_t escape(size_t offset)
+    {
+        if (offset + 1 >= m_input.size()) {
+            return 0;
+        }
+
+        const auto introducer = m_input[offset + 1];
+
+        if (introducer != '[' && introducer != 'O') {
+            return 2;
+        }
+
+        auto end = offset + 2;
+
+        while (end < m_input.size() && (m_input[end] < 0x40 || m_input[end] > 0x7e)) {
+            end++;
+        }
+
+        if (end >= m_input.size()) {
+            return 0;
+        }
+
+        const auto parameter = std::string_view(m_input).substr(offset + 2, end - offset - 2);
+
+        switch (m_input[end]) {
+        case 'A':
+            navigate(-1);
+            break;
+        case 'B':
+            navigate(+1);
+            break;
+        case 'C':
+            m_position = next(m_position);
+            break;
+        case 'D':
+            left();
+            break;
+        case 'H':
+            m_position = 0;
+            break;
+        case 'F':
+            m_position = m_line.size();
+            break;
+        case '~':
+            if (parameter == "1" || parameter == "7") {
+                m_position = 0;
+            } else if (parameter == "4" || parameter == "8") {
+                m_position = m_line.size();
+            } else if (parameter == "3") {
+                erase(m_position, next(m_position));
+            }
+            break;
+        default:
+            break;
+        }
+
+        return end - offset + 1;
+    }
+
+    // Return the offset of the character after or before the one at the offset, in UTF-8.
+    size_t next(size_t offset) const
+    {
+        if (offset < m_line.size()) {
+            offset++;
+        }
+
+        while (offset < m_line.size() && (static_cast<unsigned char>(m_line[offset]) & 0xc0) == 0x80) {
+            offset++;
+        }
+
+        return offset;
+    }
+
+    size_t previous(size_t offset) const
+    {
+        if (offset > 0) {
+            offset--;
+        }
+
+        while (offset > 0 && (static_cast<unsigned char>(m_line[offset]) & 0xc0) == 0x80) {
+            offset--;
+        }
+
+        return offset;
+    }
+
+    void left()
+    {
+        m_position = previous(m_position);
+    }
+
+    void erase(size_t begin, size_t end)
+    {
+        m_line.erase(begin, end - begin);
+        m_position = begin;
+    }
+
+    // Move through the history, the line being edited is kept at its end.
+    void navigate(int direction)
+    {
+        if (direction < 0 && m_index == 0) {
+            return;
+        }
+
+        if (direction > 0 && m_index >= m_history.size()) {
+            return;
+        }
+
+        if (m_index == m_history.size()) {
+            m_edited = m_line;
+        }
+
+        if (direction < 0) {
+            m_index--;
+        } else {
+            m_index++;
+        }
+
+        m_line     = m_index == m_history.size() ? m_edited : m_history[m_index];
+        m_position = m_line.size();
+    }
+
+    // Complete the name of the command being typed with the longest prefix of the candidates,
+    // listing them if they have none in common beyond what's typed.
+    void complete()
+    {
+        const auto word = std::string_view(m_line).substr(0, m_position);
+
+        if (word.find_first_of(" \t") != std::string_view::npos) {
+            return;
+        }
+
+        const auto names = m_console->m_view->refresh().complete(word, m_console->m_completionLimit);
+
+        if (names.empty()) {
+            return;
+        }
+
+        auto prefix = std::string_view(names.front());
+
+        for (const auto& name : names) {
+            auto length = size_t(0);
+
+            while (length < prefix.size() && length < name.size() && prefix[length] == name[length]) {
+                length++;
+            }
+
+            prefix = prefix.substr(0, length);
+        }
+
+        if (names.size() == 1 || (prefix.size() > word.size() && prefix.substr(0, word.size()) == word)) {
+            const auto completed = names.size() == 1 ? std::string(names.front()) + ' ' : std::string(prefix);
+
+            m_line.replace(0, m_position, completed);
+            m_position = completed.size();
+            return;
+        }
+
+        std::string list = "\r\n";
+
+        for (const auto& name : names) {
+            list += name;
+            list += "  ";
+        }
+
+        list += "\r\n";
+        send(list);
+    }
+
+    // Draw the prompt and the line, highlighting the name of a command and hinting the name
+    // being typed after it.
+    void redraw(bool hint)
+    {
+        const auto colors = !m_console->m_noColor;
+        const auto word   = std::string_view(m_line).substr(0, std::min(m_line.find_first_of(" \t"), m_line.size()));
+
+        std::string_view suffix;
+
+        m_cursor.update(m_console->m_view->refresh(), m_line);
+
+        // Like the terminal, only a name being typed at the end of the line is hinted.
+        const auto command = m_cursor.command();
+        const auto name    = m_cursor.hint();
+
+        if (hint && name != nullptr && !word.empty() && word.size() == m_line.size() && m_position == word.size()) {
+            m_hint = *name;
+            suffix = std::string_view(m_hint).substr(word.size());
+        }
+
+        m_frame.assign("\r");
+        m_frame += m_prompt;
+
+        if (command != nullptr && colors) {
+            m_frame += colorEscape(Color::Green, Style::Bold);
+            m_frame += word;
+            m_frame += RESET_ESCAPE;
+            m_frame += std::string_view(m_line).substr(word.size());
+        } else {
+            m_frame += m_line;
+        }
+
+        if (!suffix.empty()) {
+            m_frame += colors ? colorEscape(Color::Yellow, Style::Normal) : std::string_view();
+            m_frame += suffix;
+            m_frame += colors ? RESET_ESCAPE : std::string_view();
+        }
+
+        m_frame += "\33[K";
+
+        // Put the cursor back where it's being edited.
+        if (const auto back = utf8Length(suffix) + utf8Length(std::string_view(m_line).substr(m_position)); back > 0) {
+            m_frame += "\33[";
+            m_frame += std::to_string(back);
+            m_frame += 'D';
+        }
+
+        send(m_frame);
+    }
+
+    QConsole*               m_console;
+    QLocalSocket*           m_socket;
+    Output                  m_output;
+    QTextStream             m_stream;
+    Cursor                  m_cursor;
+    std::string             m_prompt;
+    std::string             m_input;
+    std::string             m_line;
+    std::string             m_edited;
+    std::string             m_hint;
+    std::string             m_frame;
+    std::deque<std::string> m_history;
+    size_t                  m_index      = 0;
+    size_t                  m_position   = 0;
+    bool                    m_processing = false;
+    bool                    m_deferred   = false;
+    bool                    m_closing    = false;
+    bool                    m_return     = false;
+};
+
+QConsole::Server::~Server()
+{
+    close();
+}
+
+void QConsole::Server::close()
+{
+    m_server.close();
+
+    for (const auto session : m_sessions) {
+        session->socket()->disconnect(this);
+        session->socket()->disconnectFromServer();
+        session->deleteLater();
+    }
+
+    m_sessions.clear();
+}
+
+void QConsole::Server::accept()
+{
+    while (const auto socket = m_server.nextPendingConnection()) {
+        const auto session = new Session(m_console, socket);
+        session->setParent(this);
+        m_sessions.push_back(session);
+
+        connect(socket, &QLocalSocket::disconnected, this, [this, session]() { remove(session); });
+    }
+}
+
+void QConsole::Server::remove(Session* session)
+{
+    m_sessions.erase(std::remove(m_sessions.begin(), m_sessions.end(), session), m_sessions.end());
+
+    // The session whose line is being evaluated is deleted once it's done.
+    if (session != m_current) {
+        session->deleteLater();
+    }
+}
+
+void QConsole::Server::evaluate(Session& session, std::string_view line)
+{
+    auto& console = *m_console;
+    auto& out     = session.stream();
+
+    m_current = &session;
+
+    // The commands are given the stream of the session as their console output. The console
+    // output itself isn't redirected: the lines printed meanwhile, and the lines evaluated for
+    // the terminal while an asynchronous command is waited for, go where they always go.
+    std::string        buffer(line);
+    std::vector<Token> tokens;
+
+    if (!tokenize(buffer, tokens)) {
+        console.printError(out, std::string("Unterminated quote: ").append(line), !console.m_noColor);
+    } else if (!tokens.empty()) {
+        console.execute(tokens, false, out);
+    }
+
+    out.flush();
+    session.output().flush();
+    m_current = nullptr;
+
+    if (std::find(m_sessions.begin(), m_sessions.end(), &session) == m_sessions.end()) {
+        session.deleteLater();
+    }
+
+    resume();
+}
+
+void QConsole::Server::resume()
+{
+    for (const auto session : m_sessions) {
+        if (session->deferred()) {
+            QMetaObject::invokeMethod(session, [session]() { session->process(); }, Qt::QueuedConnection);
+        }
+    }
+}
+
+// Reader owns the blocking replxx input loop. It reads one line at a time on its own thread
+// and hands it over to the console thread, then waits until the console asks for the next
+// line. That keeps the console's event loop free while the prompt is idle.
+class QConsole::Reader : public QThread
+{
+public:
+    // The key emulated to interrupt a pending read.
+    static constexpr char32_t INTERRUPT_KEY = Replxx::KEY::BASE + 0x100;
+
+    explicit Reader(QConsole* console)
+      : m_console(console)
+      , m_canceled(false)
+      , m_reading(false)
+    {
+        m_console->m_terminal->bind_key(INTERRUPT_KEY, [this](char32_t code) {
+            Q_UNUSED(code);
+            return m_canceled ? Replxx::ACTION_RESULT::BAIL : Replxx::ACTION_RESULT::CONTINUE;
+        });
+    }
+
+    // Start the thread, discarding the state left over by a previous cancel.
+    void begin()
+    {
+        m_canceled = false;
+        m_ready.tryAcquire(m_ready.available());
+        start();
+    }
+
+    // Read the next line using the specified prompt, for the given start of the console. The
+    // line is only followed by the next one if the console wasn't restarted meanwhile.
+    void next(const std::string& prompt, quint64 generation)
+    {
+        QMutexLocker lock(&m_mutex);
+        m_prompt     = prompt;
+        m_generation = generation;
+        m_reading    = true;
+        m_ready.release();
+    }
+
+    // Check if the terminal is being read, from the request of a line until it's read.
+    bool reading() const
+    {
+        return m_reading;
+    }
+
+    // Interrupt the pending read, if any, and wait for the thread to finish.
+    void cancel()
+    {
+        m_canceled = true;
+        m_ready.release();
+        m_console->m_terminal->emulate_key_press(INTERRUPT_KEY);
+        wait();
+    }
+
+protected:
+    void run() override
+    {
+        for (;;) {
+            m_ready.acquire();
+
+            if (m_canceled) {
+                return;
+            }
+
+            std::string prompt;
+            quint64     generation;
+            {
+                QMutexLocker lock(&m_mutex);
+                prompt     = m_prompt;
+                generation = m_generation;
+            }
+
+            // Read user input, copying it before the console may modify the terminal again.
+            const auto  input = m_console->m_terminal->input(prompt);
+            const auto  eof   = input == nullptr;
+            std::string line  = eof ? std::string() : std::string(input);
+            m_reading         = false;
+
+            // The candidates still on their way are for a line that isn't edited anymore.
+            m_console->m_completer->submitted();
+
+            if (m_canceled) {
+                return;
+            }
+
+            // Handle EOF (ctrl+d)
+            if (eof) {
+                QMetaObject::invokeMethod(
+                  m_console, []() { QCoreApplication::quit(); }, Qt::QueuedConnection);
+                return;
+            }
+
+            QMetaObject::invokeMethod(
+              m_console,
+              [console = m_console, line = std::move(line), generation]() {
+                  console->evaluateLine(line);
+
+                  if (console->m_running && console->m_generation == generation) {
+                      console->readNextLine();
+                  }
+              },
+              Qt::QueuedConnection);
+        }
+    }
+
+private:
+    QConsole*         m_console;
+    QSemaphore        m_ready;
+    QMutex            m_mutex;
+    std::string       m_prompt;
+    quint64           m_generation = 0;
+    std::atomic<bool> m_canceled;
+    std::atomic<bool> m_reading;
+};
+
+QConsole::QConsole(QObject* parent)
+  : QConsole(std::make_shared<Registry>(), parent)
+{
+}
+
+QConsole::QConsole(std::shared_ptr<Registry> registry, QObject* parent)
+  : QObject(parent)
+  , m_registry(std::move(registry))
+  , m_scopes(new Scopes())
+  , m_view(new View(*m_registry, *m_scopes))
+  , m_terminalView(new View(*m_registry, *m_scopes))
+  , m_terminal(new Terminal())
+  , m_reader(nullptr)
+  , m_messages(new MessageQueue())
+  , m_cursor(new Cursor())
+  , m_hintCursor(new Cursor())
+  , m_completer(new Completer())
+  , m_journal(new Journal())
+  , m_history(new History())
+  , m_output(new Output())
+  , m_metrics(new Metrics())
+  , m_tracer(new Tracer())
+  , m_server(nullptr)
+  , m_depth(0)
+  , m_terminalHistoryReset(false)
+  , m_completionLimit(100)
+  , m_echo(true)
+  , m_running(false)
+  , m_scripting(false)
+  , m_stopOnError(true)
+  , m_scriptMode(false)
+  , m_waiting(false)
+  , m_stdout(true)
+  , m_noColor(false)
+  , m_pager(false)
+  , m_generation(0)
+  , m_ostream(m_output)
+  , m_utf8(this)
+{
+    m_terminal->set_max_hint_rows(0);
+    // Navigating the history first picks up the lines appended by the other sessions sharing it.
+    const auto navigate = [this](Replxx::ACTION action) {
+        return [this, action](char32_t code) {
+            const auto span = m_tracer->span("navigate");
+
+            if (auto tail = m_journal->tail(); tail.reset || !tail.lines.empty()) {
+                const auto added = m_tracer->span("history_add");
+
+                if (tail.reset) {
+                    m_terminal->history_clear();
+                }
+
+                for (const auto& line : tail.lines) {
+                    m_terminal->history_add(line.text);
+                }
+
+                QMetaObject::invokeMethod(
+                  this, [this, tail = std::move(tail)]() { mergeHistory(tail.reset, tail.lines, false); },
+                  Qt::QueuedConnection);
+            }
+
+            return m_terminal->invoke(action, code);
+        };
+    };
+
+    m_terminal->bind_key(Replxx::KEY::UP, navigate(Replxx::ACTION::HISTORY_PREVIOUS));
+    m_terminal->bind_key(Replxx::KEY::DOWN, navigate(Replxx::ACTION::HISTORY_NEXT));
+    m_terminal->bind_key(Replxx::KEY::control('P'), navigate(Replxx::ACTION::HISTORY_PREVIOUS));
+    m_terminal->bind_key(Replxx::KEY::control('N'), navigate(Replxx::ACTION::HISTORY_NEXT));
+    m_terminal->bind_key(Replxx::KEY::control('R'), navigate(Replxx::ACTION::HISTORY_INCREMENTAL_SEARCH));
+    m_terminal->set_max_history_size(10000);
+    m_terminal->set_word_break_characters(" \t,%!;:=*~^'\"/?<>|[](){}");
+    m_terminal->set_completion_count_cutoff(256);
+    m_terminal->set_double_tab_completion(false);
+    m_terminal->set_complete_on_empty(true);
+    m_terminal->set_beep_on_ambiguous_completion(true);
+    m_terminal->set_no_color(false);
+    m_terminal->set_unique_history(true);
+
+    // The callbacks run on the reader thread, which has its own view of the registry.
+    m_terminal->set_hint_callback([this](std::string const& input, int& input_length, Replxx::Color& color) {
+        const auto span = m_tracer->span("hint");
+
+        if (input_length > 0 && input.find_first_of(" \t") == std::string::npos) {
+            m_cursor->update(m_terminalView->refresh(), input);
+
+            if (const auto name = m_cursor->hint(); name != nullptr) {
+                color = Replxx::Color::BROWN;
+                return Replxx::hints_t({ *name });
+            }
+        }
+
+        return Replxx::hints_t();
+    });
+
+    m_terminal->set_completion_callback([this](const std::string& input, int& input_length) {
+        const auto span = m_tracer->span("complete");
+
+        Replxx::completions_t completions;
+
+        // Complete the name of the command, which is replaced as a whole.
+        if (const auto blank = input.find_last_of(" \t"); blank == std::string::npos) {
+            input_length = utf8Length(input);
+
+            for (auto& name : m_terminalView->refresh().complete(input, m_completionLimit)) {
+                completions.emplace_back(Replxx::Completion(std::move(name), Replxx::Color::BROWN));
+            }
+        } else {
+            input_length = utf8Length(std::string_view(input).substr(blank + 1));
+
+            for (const auto& candidate : completeArgument(input, *m_terminalView)) {
+                completions.emplace_back(Replxx::Completion(candidate.toStdString(), Replxx::Color::DEFAULT));
+            }
+        }
+
+        return completions;
+    });
+
+    m_terminal->set_highlighter_callback([this](const std::string& input, Replxx::colors_t& colors) {
+        const auto span = m_tracer->span("highlight");
+        m_completer->edited(input);
+        m_cursor->update(m_terminalView->refresh(), input);
+
+        if (m_cursor->command() != nullptr) {
+            for (size_t i = 0; i < m_cursor->word().size(); i++) {
+                colors.at(i) = Replxx::Color::BRIGHTGREEN;
+            }
+        }
+    });
+
+    m_reader = new Reader(this);
+    m_reader->setObjectName(QStringLiteral("QConsole reader"));
+}
+
+void QConsole::start()
+{
+    // Piped or redirected input is only read in script mode, then the application exits with the
+    // status of the script.
+    if (!isInteractive()) {
+        if (!m_scriptMode) {
+            return;
+        }
+
+        QMetaObject::invokeMethod(
+          this,
+          [this]() {
+              QFile input;
+              input.open(stdin, QIODevice::ReadOnly);
+              QCoreApplication::exit(runScript(&input));
+          },
+          Qt::QueuedConnection);
+        return;
+    }
+
+    if (!m_running) {
+        m_running = true;
+        m_waiting = false;
+        m_generation++;
+        m_terminal->install_window_change_handler();
+        m_reader->begin();
+        readNextLine();
+    }
+}
+
+void QConsole::stop()
+{
+    m_scripting = false;
+
+    if (m_running) {
+        m_running = false;
+        m_reader->cancel();
+    }
+}
+
+void QConsole::readNextLine()
+{
+    if (!m_waiting) {
+        // The terminal draws the prompt itself, after what's been written.
+        flushOutput();
+        applyTerminalHistory();
+        m_reader->next(m_prompt, m_generation);
+    }
+}
+
+bool QConsole::running()
+{
+    return m_running;
+}
+
+QConsole::~QConsole()
+{
+    if (m_running) {
+        m_reader->cancel();
+        m_terminal->invoke(Replxx::ACTION::CLEAR_SELF, 0);
+    }
+
+    if (!m_echo) {
+        setStdinEcho(true);
+    }
+
+    drainMessages();
+
+    delete m_server;
+
+    m_ostream.setDevice(nullptr);
+    m_output->flush();
+
+    delete m_tracer;
+    delete m_metrics;
+    delete m_output;
+    delete m_history;
+    delete m_journal;
+    delete m_completer;
+    delete m_hintCursor;
+    delete m_cursor;
+    delete m_messages;
+    delete m_reader;
+    delete m_terminal;
+    delete m_terminalView;
+    delete m_view;
+    delete m_scopes;
+}
+
+QConsole* QConsole::createSession(QObject* parent)
+{
+    return new QConsole(m_registry, parent);
+}
+
+void QConsole::setOutputDevice(QIODevice* device)
+{
+    m_ostream.flush();
+    m_output->setDevice(device);
+    m_stdout = device == nullptr;
+}
+
+void QConsole::setOutputBuffering(Buffering buffering, int maxLatency)
+{
+    m_ostream.flush();
+    m_output->setBuffering(buffering, maxLatency);
+}
+
+void QConsole::flushOutput()
+{
+    m_ostream.flush();
+    m_output->flush();
+}
+
+QConsole::OutputStatistics QConsole::outputStatistics() const
+{
+    return m_output->statistics();
+}
+
+QConsole::Utf8Stream& QConsole::utf8Stream()
+{
+    return m_utf8;
+}
+
+QConsole::Utf8Stream::Utf8Stream(QConsole* console)
+  : m_console(console)
+{
+}
+
+QConsole::Utf8Stream& QConsole::Utf8Stream::operator<<(std::string_view text)
+{
+    // Text written to the output text stream goes first.
+    m_console->m_ostream.flush();
+    m_console->m_output->append(text.data(), text.size());
+    return *this;
+}
+
+QConsole::Utf8Stream& QConsole::Utf8Stream::operator<<(const char* text)
+{
+    return *this << std::string_view(text);
+}
+
+QConsole::Utf8Stream& QConsole::Utf8Stream::operator<<(char c)
+{
+    return *this << std::string_view(&c, 1);
+}
+
+QConsole::Utf8Stream& QConsole::Utf8Stream::operator<<(const QByteArray& text)
+{
+    return *this << std::string_view(text.constData(), static_cast<size_t>(text.size()));
+}
+
+QConsole::Utf8Stream& QConsole::Utf8Stream::operator<<(const QString& text)
+{
+    m_console->m_ostream.flush();
+
+    // The text is encoded in place, at the end of the buffer.
+    QStringEncoder encoder(QStringEncoder::Utf8);
+    const auto     begin = m_console->m_output->reserve(static_cast<size_t>(encoder.requiredSpace(text.size())));
+    m_console->m_output->commit(begin, encoder.appendToBuffer(begin, text));
+    return *this;
+}
+
+QConsole::Utf8Stream& QConsole::Utf8Stream::writeInteger(qlonglong value)
+{
+    char buffer[24];
+    const auto [end, error] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    Q_UNUSED(error);
+    return *this << std::string_view(buffer, static_cast<size_t>(end - buffer));
+}
+
+QConsole::Utf8Stream& QConsole::Utf8Stream::writeInteger(qulonglong value)
+{
+    char buffer[24];
+    const auto [end, error] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    Q_UNUSED(error);
+    return *this << std::string_view(buffer, static_cast<size_t>(end - buffer));
+}
+
+QConsole::Utf8Stream& QConsole::Utf8Stream::operator<<(const Paint& paint)
+{
+    if (!m_console->colored()) {
+        return *this;
+    }
+
+    const auto style = static_cast<size_t>(paint.m_style);
+
+    switch (paint.m_kind) {
+    case Paint::Kind::Reset:
+        return *this << RESET_ESCAPE;
+    case Paint::Kind::Basic:
+        return *this << colorEscape(static_cast<Color>(paint.m_value), paint.m_style);
+    case Paint::Kind::Palette:
+        return *this << PALETTE_ESCAPES[style] << paint.m_value << 'm';
+    case Paint::Kind::Rgb:
+        return *this << RGB_ESCAPES[style] << (paint.m_value >> 16) << ';' << ((paint.m_value >> 8) & 0xff) << ';'
+                     << (paint.m_value & 0xff) << 'm';
+    }
+
+    return *this;
+}
+
+void QConsole::Utf8Stream::flush()
+{
+    m_console->flushOutput();
+}
+
+bool QConsole::invokeCommandByName(const QString& name, const Context& ctx)
+{
+    const auto command = name.toStdString();
+
+    // The snapshot keeps the command alive while it runs, even if it's removed meanwhile. The
+    // command is found in the same snapshot, without refreshing the view again.
+    const auto& view     = m_view->refresh();
+    const auto  snapshot = view.snapshot();
+
+    if (const auto c = view.find(command); c != nullptr) {
+        const Context context{ Arguments(ctx.arguments.begin(), ctx.arguments.size()), ctx.input, ctx.output,
+                               ctx.console ? ctx.console : &m_ostream, ctx.stream };
+
+        if (c->invokeAsync) {
+            invokeAsync(*c, context, false);
+        } else {
+            QElapsedTimer timer;
+            timer.start();
+
+            try {
+                const auto span   = m_tracer->span("invoke", command);
+                const auto status = c->invoke(context);
+                m_metrics->record(command, timer.nsecsElapsed(), status != 0);
+            } catch (...) {
+                m_metrics->record(command, timer.nsecsElapsed(), true);
+                throw;
+            }
+        }
+
+        if (context.stream) {
+            context.stream->flush();
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+int QConsole::invokeCommandByName(const QString& name, const Arguments& arguments, QByteArray& output)
+{
+    QBuffer buffer(&output);
+    buffer.open(QIODevice::WriteOnly | QIODevice::Append);
+
+    return invokeCommand(name.toStdString(), arguments.begin(), arguments.size(), nullptr, &buffer, false, m_ostream);
+}
+
+QList<QString> QConsole::completions(const QString& input)
+{
+    QList<QString> result;
+
+    if (const auto text = input.toStdString(); text.find_first_of(" \t") == std::string::npos) {
+        for (const auto& name : m_view->refresh().complete(text, m_completionLimit)) {
+            result.append(QString::fromStdString(name));
+        }
+    } else {
+        result = completeArgument(text, *m_view);
+    }
+
+    return result;
+}
+
+QString QConsole::hint(const QString& input)
+{
+    if (const auto text = input.toStdString(); !text.empty() && text.find_first_of(" \t") == std::string::npos) {
+        m_hintCursor->update(m_view->refresh(), text);
+
+        if (const auto name = m_hintCursor->hint(); name != nullptr) {
+            return QString::fromStdString(*name);
+        }
+    }
+
+    return QString();
+}
+
+QList<QString> QConsole::searchHistory(const QString& pattern, int limit)
+{
+    QList<QString> result;
+
+    const auto count = limit < 0 ? m_history->size() : static_cast<size_t>(limit);
+
+    for (const auto entry : m_history->search(pattern.toStdString(), 0, count)) {
+        result.append(QString::fromStdString(entry->text));
+    }
+
+    return result;
+}
+
+QList<QString> QConsole::completeArgument(std::string_view line, View& view)
+{
+    const auto start = line.find_last_of(" \t") + 1;
+
+    std::string        buffer(line.substr(0, start));
+    std::vector<Token> tokens;
+
+    if (!tokenize(buffer, tokens)) {
+        return QList<QString>();
+    }
+
+    // Only the command after the last operator is completed.
+    const auto first =
+      std::find_if(tokens.rbegin(), tokens.rend(), [](const Token& token) { return token.kind != TokenKind::Word; })
+        .base();
+    const auto count = static_cast<qsizetype>(tokens.end() - first);
+
+    QList<QString> candidates;
+
+    if (count == 0) {
+        for (const auto& name : view.refresh().complete(line.substr(start), m_completionLimit)) {
+            candidates.append(QString::fromStdString(name));
+        }
+
+        return candidates;
+    }
+
+    if (const auto c = view.refresh().find(first->text); c == nullptr || !c->complete) {
+        return candidates;
+    }
+
+    const auto key  = QByteArray(line.data(), static_cast<qsizetype>(start));
+    const auto word = toQString(line.substr(start));
+
+    if (m_completer->cached(key, word, candidates)) {
+        if (candidates.size() > static_cast<qsizetype>(m_completionLimit)) {
+            candidates.resize(static_cast<qsizetype>(m_completionLimit));
+        }
+
+        return candidates;
+    }
+
+    if (const auto request = m_completer->request(line); request != 0) {
+        const Context ctx{ Arguments(&*first + 1, count - 1) };
+
+        QMetaObject::invokeMethod(
+          this,
+          [this, request, key, name = toQString(*first), word, ctx]() { requestCompletions(request, key, name, word, ctx); },
+          Qt::QueuedConnection);
+    }
+
+    return candidates;
+}
+
+void QConsole::requestCompletions(quint64 request, const QByteArray& key, const QString& name, const QString& word,
+                                  const Context& ctx)
+{
+    const auto& view     = m_view->refresh();
+    const auto  snapshot = view.snapshot();
+    const auto  c        = view.find(name.toStdString());
+
+    if (c == nullptr || !c->complete) {
+        m_completer->finish(request, key, word, QList<QString>(), 0);
+        return;
+    }
+
+    const auto cacheTime = c->completeCacheTime;
+    auto       future    = c->complete(ctx, word);
+
+    if (!m_completer->started(request, future)) {
+        future.cancel();
+        return;
+    }
+
+    auto watcher = new QFutureWatcher<QList<QString>>(this);
+
+    connect(watcher, &QFutureWatcher<QList<QString>>::finished, this, [this, watcher, request, key, word, cacheTime]() {
+        watcher->deleteLater();
+
+        QList<QString> candidates;
+
+        try {
+            watcher->waitForFinished();
+
+            if (!watcher->isCanceled() && watcher->future().resultCount() > 0) {
+                candidates = watcher->result();
+            }
+        } catch (const std::exception& e) {
+            print(QConsole::colorize(QStringLiteral("Completion failed: ").append(e.what()), QConsole::Color::Red,
+                                     QConsole::Style::Normal));
+        }
+
+        candidates.removeIf([&word](const QString& candidate) { return !candidate.startsWith(word); });
+
+        const bool found = !candidates.isEmpty();
+
+        // The key would go to the next line if the line was submitted meanwhile.
+        if (m_completer->finish(request, key, word, std::move(candidates), cacheTime) && found && m_running
+            && m_reader->reading() && m_completer->editing()) {
+            m_terminal->emulate_key_press(Replxx::KEY::TAB);
+        }
+    });
+
+    watcher->setFuture(future);
+}
+
+void QConsole::invokeAsync(const Command& command, const Context& ctx, bool wait)
+{
+    auto          watcher = new QFutureWatcher<void>(this);
+    const auto    begin   = m_tracer->enabled() ? Tracer::now() : 0;
+    QElapsedTimer timer;
+    timer.start();
+
+    // The latency of the command runs until its future finishes.
+    connect(watcher, &QFutureWatcher<void>::finished, this,
+            [this, watcher, wait, timer, begin, name = command.name.toStdString(), generation = m_generation]() {
+                watcher->deleteLater();
+
+                auto failed = false;
+
+                try {
+                    watcher->waitForFinished();
+                } catch (const std::exception& e) {
+                    failed = true;
+                    print(QConsole::colorize(QStringLiteral("Command failed: ").append(e.what()), QConsole::Color::Red,
+                                             QConsole::Style::Normal));
+                }
+
+                m_metrics->record(name, timer.nsecsElapsed(), failed);
+
+                if (begin != 0) {
+                    m_tracer->record("invokeAsync", begin, Tracer::now(), name);
+                }
+
+                if (wait && m_waiting && m_generation == generation) {
+                    m_waiting = false;
+                    m_ostream << "\r\33[2K";
+                    flushOutput();
+
+                    if (m_running) {
+                        readNextLine();
+                    }
+                }
+            });
+
+    if (wait) {
+        m_waiting = true;
+        m_ostream << m_busyPrompt.c_str();
+        flushOutput();
+    }
+
+    watcher->setFuture(command.invokeAsync(ctx));
+}
+
+QTextStream& QConsole::Context::ostream() const
+{
+    if (output != nullptr) {
+        if (!stream) {
+            stream = std::make_shared<QTextStream>(output);
+        }
+
+        return *stream;
+    }
+
+    if (console != nullptr) {
+        return *console;
+    }
+
+    // A context made outside of the console writes to the standard output through its own
+    // stream, streams can't be shared between threads.
+    if (!stream) {
+        stream = std::make_shared<QTextStream>(stdout);
+    }
+
+    return *stream;
+}
+
+void QConsole::page(const Context& ctx, const Producer& producer)
+{
+    auto&       out = ctx.ostream();
+    std::string line;
+
+    if (&out != &m_ostream) {
+        while (producer(line)) {
+            out << line.c_str() << '\n';
+            line.clear();
+        }
+
+        out.flush();
+        return;
+    }
+
+    // The pager reads the keys itself, which it can't do while the line editor reads them.
+    if (m_pager && m_stdout && !m_scripting && isTerminalOutput() && isInteractive() && !m_reader->reading()) {
+        flushOutput();
+        Pager(producer, *m_output).run();
+        return;
+    }
+
+    while (producer(line)) {
+        m_utf8 << line << '\n';
+        line.clear();
+    }
+}
+
+void QConsole::setPagerEnabled(bool enabled)
+{
+    m_pager = enabled;
+}
+
+void QConsole::setTracingEnabled(bool enabled)
+{
+    m_tracer->setEnabled(enabled);
+}
+
+QByteArray QConsole::traceJson() const
+{
+    return m_tracer->json();
+}
+
+void QConsole::clearTrace()
+{
+    m_tracer->clear();
+}
+
+QList<QConsole::CommandMetrics> QConsole::metrics() const
+{
+    return m_metrics->snapshot();
+}
+
+QByteArray QConsole::metricsJson() const
+{
+    QJsonArray commands;
+
+    for (const auto& m : m_metrics->snapshot()) {
+        commands.append(QJsonObject{
+          { "name", m.name },
+          { "invocations", static_cast<qint64>(m.invocations) },
+          { "errors", static_cast<qint64>(m.errors) },
+          { "latency",
+            QJsonObject{
+              { "min", m.min },
+              { "mean", m.mean },
+              { "p50", m.p50 },
+              { "p90", m.p90 },
+              { "p99", m.p99 },
+              { "p999", m.p999 },
+              { "max", m.max },
+            } },
+        });
+    }
+
+    return QJsonDocument(QJsonObject{ { "unit", "ns" }, { "commands", commands } }).toJson(QJsonDocument::Compact);
+}
+
+void QConsole::resetMetrics()
+{
+    m_metrics->reset();
+}
+
+QString QConsole::colorize(const QString& str, const Color& color, const Style& style)
+{
+    const auto escape = colorEscape(color, style);
+
+    QString result;
+    result.reserve(static_cast<qsizetype>(escape.size() + RESET_ESCAPE.size()) + str.size());
+    result.append(QLatin1String(escape.data(), static_cast<qsizetype>(escape.size())))
+      .append(str)
+      .append(QLatin1String(RESET_ESCAPE.data(), static_cast<qsizetype>(RESET_ESCAPE.size())));
+
+    return result;
+}
+
+QConsole::Command::AsyncCallback QConsole::runInThreadPool(Command::Callback callback, QThreadPool* pool)
+{
+    return [callback = std::move(callback), pool](const Context& ctx) {
+        auto promise = std::make_shared<QPromise<void>>();
+        auto future  = promise->future();
+
+        promise->start();
+
+        (pool ? pool : QThreadPool::globalInstance())->start([callback, promise, ctx]() {
+            // An exception would end the thread of the pool and leave the future running forever,
+            // it fails the future instead.
+            try {
+                callback(ctx);
+            } catch (...) {
+                promise->setException(std::current_exception());
+            }
+
+            promise->finish();
+        });
+
+        return future;
+    };
+}
+
+QConsole::Command::CompleteCallback QConsole::completeInThreadPool(
+  std::function<QList<QString>(const Context& ctx, const QString& word)> callback, QThreadPool* pool)
+{
+    return [callback = std::move(callback), pool](const Context& ctx, const QString& word) {
+        auto promise = std::make_shared<QPromise<QList<QString>>>();
+        auto future  = promise->future();
+
+        promise->start();
+
+        (pool ? pool : QThreadPool::globalInstance())->start([callback, promise, ctx, word]() {
+            // Skip the requests canceled before they got a thread.
+            if (!promise->isCanceled()) {
+                try {
+                    promise->addResult(callback(ctx, word));
+                } catch (...) {
+                    promise->setException(std::current_exception());
+                }
+            }
+
+            promise->finish();
+        });
+
+        return future;
+    };
+}
+
+void QConsole::print(const QString& message)
+{
+    m_messages->push(message.toUtf8());
+
+    if (QThread::currentThread() == thread()) {
+        // Keep the order of the lines printed and the ones written to the output stream.
+        drainMessages();
+    } else if (m_messages->schedule()) {
+        QMetaObject::invokeMethod(this, [this]() { drainMessages(); }, Qt::QueuedConnection);
+    }
+}
+
+void QConsole::drainMessages()
+{
+    m_messages->unschedule();
+
+    QByteArray batch;
+    QByteArray message;
+
+    while (m_messages->pop(message)) {
+        batch.append(message).append('\n');
+    }
+
+    if (const auto dropped = m_messages->takeDropped(); dropped > 0) {
+        batch.append(QConsole::colorize(QStringLiteral("%1 message(s) dropped").arg(dropped), QConsole::Color::Red,
+                                        QConsole::Style::Normal)
+                       .toUtf8())
+          .append('\n');
+    }
+
+    if (batch.isEmpty()) {
+        return;
+    }
+
+    flushOutput();
+
+    if (m_stdout) {
+        // The terminal prints the batch above the line being edited, if any.
+        m_terminal->print("%.*s", static_cast<int>(batch.size()), batch.constData());
+    } else {
+        m_output->append(batch.constData(), static_cast<size_t>(batch.size()));
+    }
+}
+
+bool QConsole::evaluateLine(std::string_view line)
+{
+    // Nested evaluations can't reuse the buffers since the outer command still refers to them.
+    std::string        nestedLine;
+    std::vector<Token> nestedTokens;
+
+    auto& buffer = m_depth == 0 ? m_line : nestedLine;
+    auto& tokens = m_depth == 0 ? m_tokens : nestedTokens;
+
+    while (!line.empty() && isBlank(line.front())) {
+        line.remove_prefix(1);
+    }
+
+    while (!line.empty() && isBlank(line.back())) {
+        line.remove_suffix(1);
+    }
+
+    if (line.empty()) {
+        return true;
+    }
+
+    const auto span = m_tracer->span("evaluateLine");
+    appendHistory(line);
+
+    buffer.assign(line);
+    tokens.clear();
+
+    if (!tokenize(buffer, tokens)) {
+        m_utf8 << ERROR_PAINT << "Unterminated quote: " << line << QConsole::Paint::reset() << '\n';
+        return false;
+    }
+
+    return execute(tokens, true, m_ostream) == 0;
+}
+
+void QConsole::appendHistory(std::string_view line)
+{
+    const HistoryLine entry{ currentTimestamp(), std::string(line) };
+    const auto        tail = m_journal->append(entry);
+
+    mergeHistory(tail.reset, tail.lines, true);
+
+    const auto span = m_tracer->span("history_add");
+    addTerminalHistory(false, &entry.text, 1);
+    m_history->add(entry.text, entry.timestamp);
+}
+
+void QConsole::addTerminalHistory(bool reset, const std::string* lines, size_t count)
+{
+    // Replxx's history isn't thread-safe: while the reader is reading a line, the lines wait for
+    // the next one.
+    if (reset) {
+        m_terminalHistory.clear();
+        m_terminalHistoryReset = true;
+    }
+
+    m_terminalHistory.insert(m_terminalHistory.end(), lines, lines + count);
+
+    if (!m_reader->reading()) {
+        applyTerminalHistory();
+    }
+}
+
+void QConsole::applyTerminalHistory()
+{
+    if (std::exchange(m_terminalHistoryReset, false)) {
+        m_terminal->history_clear();
+    }
+
+    for (const auto& line : m_terminalHistory) {
+        m_terminal->history_add(line);
+    }
+
+    m_terminalHistory.clear();
+}
+
+void QConsole::addHistory(const QString& line)
+{
+    if (const auto text = line.trimmed().toStdString(); !text.empty()) {
+        appendHistory(text);
+    }
+}
+
+int QConsole::evaluate(const QString& line)
+{
+    auto               buffer = line.toStdString();
+    std::vector<Token> tokens;
+
+    if (!tokenize(buffer, tokens)) {
+        m_utf8 << ERROR_PAINT << "Unterminated quote: " << line << QConsole::Paint::reset() << '\n';
+        return 2;
+    }
+
+    return tokens.empty() ? 0 : execute(tokens, false, m_ostream);
+}
+
+int QConsole::execute(const std::vector<Token>& tokens, bool interactive, QTextStream& out)
+{
+    // Every operator follows a command and precedes another one, except for a final ";".
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        if (tokens[i].kind == TokenKind::Word) {
+            continue;
+        }
+
+        if (i == 0 || tokens[i - 1].kind != TokenKind::Word
+            || (i + 1 == tokens.size() && tokens[i].kind != TokenKind::Sequence)) {
+            printError(out, std::string("Syntax error near: ").append(tokens[i].text), !m_noColor);
+            return 2;
+        }
+    }
+
+    int       status   = 0;
+    TokenKind previous = TokenKind::Sequence;
+
+    for (size_t i = 0; i < tokens.size();) {
+        auto j = i;
+
+        while (j < tokens.size() && (tokens[j].kind == TokenKind::Word || tokens[j].kind == TokenKind::Pipe)) {
+            j++;
+        }
+
+        // "&&" runs the pipeline if the previous one succeeded and "||" if it failed.
+        if (previous == TokenKind::Sequence || (previous == TokenKind::And) == (status == 0)) {
+            status = pipeline(tokens.data() + i, j - i, interactive && i == 0 && j == tokens.size(), out);
+        }
+
+        if (j < tokens.size()) {
+            previous = tokens[j].kind;
+        }
+
+        i = j + 1;
+    }
+
+    return status;
+}
+
+int QConsole::pipeline(const Token* tokens, size_t count, bool alone, QTextStream& out)
+{
+    int                      status = 0;
+    std::unique_ptr<QBuffer> input;
+
+    // The arguments are views of the tokens, as contiguous as the command expects them.
+    QVarLengthArray<std::string_view, 16> arguments;
+
+    for (size_t i = 0; i < count;) {
+        auto j = i;
+
+        while (j < count && tokens[j].kind != TokenKind::Pipe) {
+            j++;
+        }
+
+        arguments.clear();
+
+        for (auto k = i + 1; k < j; ++k) {
+            arguments.append(tokens[k].text);
+        }
+
+        // The output of a command is kept in memory, and the next command reads the same buffer.
+        std::unique_ptr<QBuffer> output;
+
+        if (j < count) {
+            output = std::make_unique<QBuffer>();
+            output->open(QIODevice::WriteOnly);
+        }
+
+        status = invokeCommand(tokens[i].text, arguments.constData(), arguments.size(), input.get(), output.get(), alone,
+                               out);
+
+        if (output) {
+            output->close();
+            output->open(QIODevice::ReadOnly);
+        }
+
+        input = std::move(output);
+        i     = j + 1;
+    }
+
+    return status;
+}
+
+int QConsole::invokeCommand(std::string_view name, const std::string_view* arguments, qsizetype count,
+                            QIODevice* input, QIODevice* output, bool alone, QTextStream& out)
+{
+    // The snapshot keeps the command alive while it runs, even if it's removed meanwhile. The
+    // command is found in the same snapshot, without refreshing the view again.
+    const auto& view     = m_view->refresh();
+    const auto  snapshot = view.snapshot();
+    const auto  c        = view.find(name);
+
+    if (c == nullptr) {
+        printError(out, std::string("Command not found: ").append(name), !m_noColor);
+        return 127;
+    }
+
+    const Context ctx{ Arguments(arguments, count), input, output, &out };
 
-    m_terminal->set_completion_callback([this](const std::string& input, int& input_length) {
-        Q_UNUSED(input_length);
+    m_scopes->used(name);
 
-        Replxx::completions_t completions;
+    int           status  = 0;
+    auto          pending = false;
+    QElapsedTimer timer;
 
-        const auto& pr = m_commands->equal_prefix_range(input);
-        for (auto iter = pr.first; iter != pr.second; ++iter) {
-            completions.emplace_back(Replxx::Completion(iter.key(), Replxx::Color::BROWN));
-        }
+    m_depth++;
+    timer.start();
 
-        return completions;
-    });
+    try {
+        const auto span = m_tracer->span("invoke", name);
 
-    m_terminal->set_highlighter_callback([this](const std::string& input, Replxx::colors_t& colors) {
-        size_t prefixHighlightLength = 0;
-        size_t endOfWord = input.find(" "); // Check to see if we have multiple words (i.e. command + arguments)
+        if (c->invokeAsync && (m_scripting || !alone)) {
+            // Scripts, chains and pipelines wait for the command, with the event loop running.
+            QFutureWatcher<void> watcher;
+            QEventLoop           loop;
 
-        if (endOfWord == std::string::npos) {
-            if (const auto c = findCommandByName(input); c != nullptr) {
-                prefixHighlightLength = input.length();
-            }
-        } else {
-            if (const auto c = findCommandByName(input.substr(0, endOfWord)); c != nullptr) {
-                prefixHighlightLength = endOfWord;
+            connect(&watcher, &QFutureWatcher<void>::finished, &loop, &QEventLoop::quit);
+            watcher.setFuture(c->invokeAsync(ctx));
+
+            if (!watcher.isFinished()) {
+                loop.exec();
             }
-        }
 
-        for (size_t i = 0; i < prefixHighlightLength; i++) {
-            colors.at(i) = Replxx::Color::BRIGHTGREEN;
+            watcher.waitForFinished();
+        } else if (c->invokeAsync) {
+            // The invocation is recorded once the command has finished.
+            invokeAsync(*c, ctx, !m_busyPrompt.empty());
+            pending = true;
+        } else {
+            status = c->invoke(ctx);
         }
-    });
+    } catch (const std::exception& e) {
+        printError(out, std::string("Command failed: ").append(e.what()), !m_noColor);
+        status = 1;
+    }
 
-    m_commands->burst_threshold(0);
-    m_commands->max_load_factor(1.0);
-}
+    if (!pending) {
+        m_metrics->record(name, timer.nsecsElapsed(), status != 0);
+    }
 
-void QConsole::start()
-{
-    if (!m_running) {
-        m_timerID = startTimer(0, Qt::TimerType::CoarseTimer);
-        m_running = true;
-        m_terminal->install_window_change_handler();
+    if (ctx.stream) {
+        ctx.stream->flush();
     }
-}
 
-void QConsole::stop()
-{
-    if (m_running) {
-        killTimer(m_timerID);
-        m_running = false;
+    // The remote sessions wait for the console to be idle to evaluate their lines.
+    if (--m_depth == 0 && m_server != nullptr) {
+        m_server->resume();
     }
-}
 
-bool QConsole::running()
-{
-    return m_running;
+    return status;
 }
 
-QConsole::~QConsole()
+int QConsole::runScript(QIODevice* device)
 {
-    if (m_running) {
-        m_terminal->invoke(Replxx::ACTION::CLEAR_SELF, 0);
-    }
+    std::string        nestedBuffer;
+    std::vector<Token> nestedTokens;
 
-    if (!m_historyFilePath.empty()) {
-        m_terminal->history_save(m_historyFilePath);
-    }
+    // The lines are tokenized in place, in the blocks read from the device.
+    auto& buffer = m_depth == 0 ? m_line : nestedBuffer;
+    auto& tokens = m_depth == 0 ? m_tokens : nestedTokens;
 
-    if (!m_echo) {
-        setStdinEcho(true);
-    }
+    const bool scripting = m_scripting;
 
-    delete m_terminal;
-    delete m_commands;
-}
+    size_t begin  = 0;
+    qint64 number = 0;
+    int    status = 0;
+    bool   more   = true;
 
-void QConsole::setOutputDevice(QIODevice* device)
-{
-    m_ostream.device()->close();
-    m_ostream.setDevice(device);
-}
+    buffer.clear();
+    m_scripting = true;
 
-bool QConsole::invokeCommandByName(const QString& name, const Context& ctx)
-{
-    if (const auto c = findCommandByName(name.toStdString()); c != nullptr) {
-        c->invoke(ctx);
-        return true;
-    }
+    while (m_scripting && more) {
+        // Keep the incomplete line at the end of the previous block and read the next one after it.
+        buffer.erase(0, begin);
+        begin = 0;
 
-    return false;
-}
+        const auto size  = buffer.size();
+        auto       count = qint64(0);
 
-void QConsole::evaluateLine(const char* line)
-{
-    const auto a = QString(line).trimmed();
+        buffer.resize(size + SCRIPT_BLOCK_SIZE);
 
-    if (a.isEmpty()) {
-        return;
-    }
+        while ((count = device->read(buffer.data() + size, SCRIPT_BLOCK_SIZE)) == 0 && device->isSequential()
+               && device->waitForReadyRead(-1)) {
+        }
 
-    const auto tokens = a.split(' ');
-    const auto name   = tokens[0].toStdString();
+        more = count > 0;
+        buffer.resize(size + static_cast<size_t>(std::max<qint64>(count, 0)));
 
-    m_terminal->history_add(a.toStdString());
+        while (m_scripting && begin < buffer.size()) {
+            const auto newline = std::memchr(buffer.data() + begin, '\n', buffer.size() - begin);
 
-    if (const auto c = findCommandByName(name); c != nullptr) {
-        return c->invoke(Context{ tokens.mid(1) });
-    }
+            // The last line of the script may not end with a newline.
+            if (newline == nullptr && more) {
+                break;
+            }
 
-    m_ostream << QConsole::colorize(QStringLiteral("Command not found: ").append(tokens[0]), QConsole::Color::Red,
-                                    QConsole::Style::Normal)
-              << Qt::endl;
-}
+            const auto end  = newline ? static_cast<size_t>(static_cast<const char*>(newline) - buffer.data()) : buffer.size();
+            auto       data = buffer.data() + begin;
+            auto       line = std::string_view(data, end - begin);
 
-void QConsole::timerEvent(QTimerEvent* event)
-{
-    Q_UNUSED(event);
+            begin = end + 1;
+            number++;
+
+            while (!line.empty() && isBlank(line.front())) {
+                line.remove_prefix(1);
+                data++;
+            }
+
+            // Blank lines and comments are skipped.
+            if (line.empty() || line.front() == '#') {
+                continue;
+            }
+
+            tokens.clear();
+
+            bool succeeded = tokenize(data, line.size(), tokens);
+
+            if (!succeeded) {
+                m_utf8 << ERROR_PAINT << "Unterminated quote on line " << number << QConsole::Paint::reset() << '\n';
+            } else if (!tokens.empty()) {
+                succeeded = execute(tokens, false, m_ostream) == 0;
+            }
 
-    // Read user input...
-    const auto input = m_terminal->input(m_prompt);
+            if (!succeeded) {
+                status = 1;
 
-    // Handle EOF (ctrl+d)
-    if (input == nullptr) {
-        QCoreApplication::quit();
+                if (m_stopOnError) {
+                    m_scripting = false;
+                }
+            }
+        }
     }
 
-    return evaluateLine(input);
+    buffer.clear();
+    m_scripting = scripting;
+    flushOutput();
+    return status;
+}
+
+void QConsole::setStopOnError(bool stop)
+{
+    m_stopOnError = stop;
+}
+
+void QConsole::setScriptMode(bool enabled)
+{
+    m_scriptMode = enabled;
 }
 
 void QConsole::setMaxHistorySize(int size)
 {
     m_terminal->set_max_history_size(size);
+    m_journal->setMaxSize(static_cast<size_t>(std::max(size, 0)));
+    m_history->setMaxSize(static_cast<size_t>(std::max(size, 0)));
 }
 
 void QConsole::setWordBreakCharacters(const char* characters)
@@ -228,6 +5304,11 @@ void QConsole::setCompletionCountCutoff(int cutoff)
     m_terminal->set_completion_count_cutoff(cutoff);
 }
 
+void QConsole::setCompletionLimit(int limit)
+{
+    m_completionLimit = static_cast<size_t>(std::max(limit, 1));
+}
+
 void QConsole::setDoubleTabCompletion(bool complete)
 {
     m_terminal->set_double_tab_completion(complete);
@@ -246,16 +5327,61 @@ void QConsole::setBeepOnAmbiguousCompletion(bool beep)
 void QConsole::setNoColor(bool color)
 {
     m_terminal->set_no_color(color);
+    m_noColor = color;
+}
+
+bool QConsole::colored() const
+{
+    return !m_noColor && (!m_stdout || isTerminalOutput());
+}
+
+bool QConsole::colored(const Context& ctx) const
+{
+    if (ctx.output != nullptr) {
+        return false;
+    }
+
+    return ctx.console != nullptr && ctx.console != &m_ostream ? !m_noColor : colored();
+}
+
+void QConsole::printError(QTextStream& out, std::string_view message, bool colors)
+{
+    if (&out == &m_ostream) {
+        m_utf8 << ERROR_PAINT << message << QConsole::Paint::reset() << '\n';
+        return;
+    }
+
+    const auto escape = colorEscape(Color::Red, Style::Normal);
+
+    if (colors) {
+        out << QLatin1String(escape.data(), static_cast<qsizetype>(escape.size()));
+    }
+
+    out << QString::fromUtf8(message.data(), static_cast<qsizetype>(message.size()));
+
+    if (colors) {
+        out << QLatin1String(RESET_ESCAPE.data(), static_cast<qsizetype>(RESET_ESCAPE.size()));
+    }
+
+    out << '\n';
 }
 
 void QConsole::setUniqueHistory(bool unique)
 {
     m_terminal->set_unique_history(unique);
+    m_journal->setUnique(unique);
+    m_history->setUnique(unique);
 }
 
 size_t QConsole::commandCount()
 {
-    return m_commands->size();
+    size_t count = 0;
+
+    for (const auto layer : m_view->refresh().layers()) {
+        count += layer->size();
+    }
+
+    return count;
 }
 
 void QConsole::addDefaultCommands()
@@ -263,8 +5389,16 @@ void QConsole::addDefaultCommands()
     addCommand({
       "exit",
       "Exit the application.",
-      [](const Context& ctx) {
+      [this](const Context& ctx) {
           Q_UNUSED(ctx);
+
+          // A remote session is closed instead.
+          if (const auto session = m_server != nullptr ? m_server->current() : nullptr; session != nullptr) {
+              session->hangUp();
+              return;
+          }
+
+          m_scripting = false;
           QCoreApplication::quit();
       },
     });
@@ -273,34 +5407,218 @@ void QConsole::addDefaultCommands()
       "help",
       "Print help information.",
       [this](const Context& ctx) {
-          Q_UNUSED(ctx);
+          std::deque<std::string> pending{ "", "List of commands:", "" };
+          std::string             buffer;
+          QStringEncoder          encoder(QStringEncoder::Utf8);
+          const auto&             view     = m_view->refresh();
+          const auto              snapshot = view.snapshot();
+          const auto              layers   = view.layers();
+          auto                    layer    = layers.begin();
+          auto                    iter     = (*layer)->begin();
+          const auto              colors   = colored(ctx);
 
-          m_ostream << "\nList of commands:\n\n";
+          // The lines are made as they're written or scrolled to, layer after layer.
+          page(ctx, [&](std::string& line) {
+              for (;;) {
+                  if (!pending.empty()) {
+                      line = std::move(pending.front());
+                      pending.pop_front();
+                      return true;
+                  }
 
-          for (auto iter = m_commands->begin(); iter != m_commands->end(); ++iter) {
-              m_ostream << QConsole::colorize(iter->name, QConsole::Color::Green) << ": " << iter->description << "\n";
-          }
+                  if (layer == layers.end()) {
+                      return false;
+                  }
+
+                  if (iter == (*layer)->end()) {
+                      if (++layer == layers.end()) {
+                          pending = { "", "Usage: <command> [arguments...]", "" };
+                      } else {
+                          pending = { "", "Commands of " + (*layer)->name + ":", "" };
+                          iter    = (*layer)->begin();
+                      }
+
+                      continue;
+                  }
+
+                  const auto command = iter++;
 
-          m_ostream << "\nUsage: <command> [arguments...]\n\n";
-          m_ostream.flush();
+                  if (View::shadowed(layers, command.key(), static_cast<size_t>(layer - layers.begin()))) {
+                      continue;
+                  }
+
+                  appendStyled(line, toUtf8(command->name, buffer, encoder), QConsole::Color::Green, colors);
+                  line.append(": ").append(toUtf8(command->description, buffer, encoder));
+                  return true;
+              }
+          });
       },
     });
 
     addCommand({
       "history",
-      "Print command history.",
+      "Print command history: history [pattern] [--last count] [--page number].",
       [this](const Context& ctx) {
-          Q_UNUSED(ctx);
+          QList<QString> words;
+          size_t         count      = 0;
+          size_t         pageNumber = 0;
+
+          for (qsizetype i = 0; i < ctx.arguments.size(); ++i) {
+              if (const auto arg = ctx.arguments.view(i); arg == "--last" || arg == "--page") {
+                  bool ok    = false;
+                  auto value = ctx.arguments.value(++i).toLongLong(&ok);
+
+                  if (!ok || value <= 0) {
+                      printError(ctx.ostream(), std::string("Invalid value for ").append(arg), colored(ctx));
+                      return 1;
+                  }
+
+                  (arg == "--last" ? count : pageNumber) = static_cast<size_t>(value);
+              } else {
+                  words.append(ctx.arguments[i]);
+              }
+          }
+
+          const auto tail = m_journal->tail();
+          mergeHistory(tail.reset, tail.lines, true);
+
+          // Pages hold the given number of entries, 20 by default, the first one being the newest.
+          if (pageNumber > 0 && count == 0) {
+              count = 20;
+          }
+
+          const auto pattern = words.join(QLatin1Char(' ')).toStdString();
+          const auto skip    = pageNumber > 0 ? (pageNumber - 1) * count : 0;
+          const auto entries = m_history->search(pattern, skip, count > 0 ? count : m_history->size());
+
+          // Print the oldest entry first, like the whole history. The entries are UTF-8 already,
+          // so the lines are made without conversions.
+          auto iter = entries.rbegin();
+
+          page(ctx, [&iter, &entries, colors = colored(ctx)](std::string& line) {
+              if (iter == entries.rend()) {
+                  return false;
+              }
+
+              const auto number = std::to_string((*iter)->number);
+              line.append(4 - std::min<size_t>(number.size(), 4), ' ').append(number).push_back(' ');
+              appendStyled(line, (*iter)->timestamp, QConsole::Color::Blue, colors);
+              line.append(1, ' ').append((*iter)->text);
+
+              ++iter;
+              return true;
+          });
+
+          return 0;
+      },
+    });
+
+    addCommand({
+      "stats",
+      "Print the invocations and latency of the commands: stats [--json] [--reset].",
+      [this](const Context& ctx) {
+          auto json  = false;
+          auto reset = false;
 
-          Replxx::HistoryScan hs(m_terminal->history_scan());
+          for (qsizetype i = 0; i < ctx.arguments.size(); ++i) {
+              if (const auto arg = ctx.arguments.view(i); arg == "--json") {
+                  json = true;
+              } else if (arg == "--reset") {
+                  reset = true;
+              } else {
+                  printError(ctx.ostream(), std::string("Invalid argument: ").append(arg), colored(ctx));
+                  return 1;
+              }
+          }
+
+          const auto               metrics = m_metrics->snapshot();
+          qsizetype                row     = -1;
+          int                      width   = 7;
+          std::vector<std::string> names;
+
+          // The names are measured in characters, like they're padded.
+          names.reserve(static_cast<size_t>(metrics.size()));
+
+          for (const auto& m : metrics) {
+              names.push_back(m.name.toStdString());
+              width = std::max(width, utf8Length(names.back()));
+          }
+
+          // The JSON document takes a single line, the table has a header then a row per command.
+          page(ctx, [&](std::string& line) {
+              if (row == metrics.size() || (json && row == 0)) {
+                  return false;
+              }
+
+              if (row++ < 0) {
+                  if (json) {
+                      line.append(metricsJson().constData());
+                  } else {
+                      line.append("command").append(static_cast<size_t>(width) - 7, ' ');
+                      line.append("      calls   errors      mean       p50       p90       p99       max");
+                  }
+
+                  return true;
+              }
+
+              const auto& m    = metrics[row - 1];
+              const auto& name = names[static_cast<size_t>(row - 1)];
+              char        counts[48];
+
+              std::snprintf(counts, sizeof(counts), " %10llu %8llu", static_cast<unsigned long long>(m.invocations),
+                            static_cast<unsigned long long>(m.errors));
+              line.append(name).append(static_cast<size_t>(std::max(width - utf8Length(name), 0)), ' ').append(counts);
+
+              for (const auto duration : { m.mean, m.p50, m.p90, m.p99, m.max }) {
+                  line.push_back(' ');
+                  appendDuration(line, duration);
+              }
+
+              return true;
+          });
+
+          if (reset) {
+              m_metrics->reset();
+          }
+
+          return 0;
+      },
+    });
+
+    addCommand({
+      "trace",
+      "Record how long callbacks and commands take: trace on|off|clear|dump [path].",
+      [this](const Context& ctx) {
+          const auto action = ctx.arguments.isEmpty() ? std::string_view() : ctx.arguments.view(0);
 
-          for (auto i = 0; hs.next(); i++) {
-              m_ostream << qSetFieldWidth(4) << i << qSetFieldWidth(0) << " "
-                        << QConsole::colorize(QString::fromStdString(hs.get().timestamp()), QConsole::Color::Blue)
-                        << " " << hs.get().text().c_str() << "\n";
+          if (action == "on" || action == "off") {
+              m_tracer->setEnabled(action == "on");
+          } else if (action == "clear") {
+              m_tracer->clear();
+          } else if (action == "dump" && ctx.arguments.size() > 1) {
+              QSaveFile file(ctx.arguments[1]);
+
+              if (!file.open(QIODevice::WriteOnly) || file.write(m_tracer->json()) < 0 || !file.commit()) {
+                  printError(ctx.ostream(), std::string("Cannot write ").append(ctx.arguments.view(1)), colored(ctx));
+                  return 1;
+              }
+          } else if (action == "dump") {
+              auto done = false;
+
+              page(ctx, [this, &done](std::string& line) {
+                  if (std::exchange(done, true)) {
+                      return false;
+                  }
+
+                  line.append(m_tracer->json().constData());
+                  return true;
+              });
+          } else {
+              printError(ctx.ostream(), "Usage: trace on|off|clear|dump [path]", colored(ctx));
+              return 1;
           }
 
-          m_ostream.flush();
+          return 0;
       },
     });
 
@@ -317,27 +5635,125 @@ void QConsole::addDefaultCommands()
       "version",
       "Print the application version.",
       [](const Context& ctx) {
-          Q_UNUSED(ctx);
-          QTextStream(stdout) << QCoreApplication::applicationVersion() << Qt::endl;
+          ctx.ostream() << QCoreApplication::applicationVersion() << Qt::endl;
       },
     });
 }
 
-void QConsole::addCommand(const Command& c)
+void QConsole::addCommand(const Command& c, const QString& scope)
+{
+    m_registry->modify(scope, true, [&c](Trie& trie, bool) { trie.insert(c.name.toStdString(), c); });
+}
+
+void QConsole::addCommand(Command&& c, const QString& scope)
+{
+    m_registry->modify(scope, true, [&c](Trie& trie, bool) {
+        const auto name = c.name.toStdString();
+        trie.emplace_ks(name.data(), name.size(), std::move(c));
+    });
+}
+
+void QConsole::addCommands(QList<Command>&& commands, const QString& scope)
+{
+    m_registry->modify(scope, true, [&commands](Trie& trie, bool sealed) {
+        QStringEncoder encoder(QStringEncoder::Utf8);
+        std::string    buffer;
+
+        for (auto& c : commands) {
+            const auto name = toUtf8(c.name, buffer, encoder);
+            trie.emplace_ks(name.data(), name.size(), std::move(c));
+        }
+
+        if (sealed) {
+            trie.seal();
+        }
+    });
+}
+
+void QConsole::removeCommands(const QList<QString>& names, const QString& scope)
+{
+    m_registry->modify(scope, false, [&names](Trie& trie, bool sealed) {
+        QStringEncoder encoder(QStringEncoder::Utf8);
+        std::string    buffer;
+
+        for (const auto& n : names) {
+            const auto name = toUtf8(n, buffer, encoder);
+            trie.erase_ks(name.data(), name.size());
+        }
+
+        if (sealed) {
+            trie.seal();
+        }
+    });
+}
+
+void QConsole::removeCommandByName(const QString& name, const QString& scope)
+{
+    m_registry->modify(scope, false, [&name](Trie& trie, bool) { trie.erase(name.toStdString()); });
+}
+
+void QConsole::removeScope(const QString& scope)
+{
+    m_registry->remove(scope);
+
+    // The other sessions skip the scope until it's created again.
+    m_scopes->modify([name = scope.toStdString()](std::vector<std::string>& names) {
+        names.erase(std::remove(names.begin(), names.end(), name), names.end());
+    });
+}
+
+void QConsole::pushScope(const QString& scope)
+{
+    const auto name   = scope.toStdString();
+    const auto active = m_scopes->names();
+
+    if (name.empty() || std::find(active->begin(), active->end(), name) != active->end()) {
+        return;
+    }
+
+    m_registry->create(scope);
+    m_scopes->modify([&name](std::vector<std::string>& names) { names.push_back(name); });
+}
+
+void QConsole::popScope()
+{
+    if (!m_scopes->names()->empty()) {
+        m_scopes->modify([](std::vector<std::string>& names) { names.pop_back(); });
+    }
+}
+
+const QString QConsole::currentScope()
+{
+    return QString::fromStdString(m_view->refresh().layers().back()->name);
+}
+
+void QConsole::seal()
 {
-    m_commands->insert(c.name.toStdString(), c);
+    m_registry->seal();
 }
 
-void QConsole::removeCommandByName(const QString& name)
+bool QConsole::sealed()
 {
-    m_commands->erase(name.toStdString());
+    const auto& layers = m_view->refresh().layers();
+
+    return std::all_of(layers.begin(), layers.end(), [](const Trie* layer) { return layer->index != nullptr; });
 }
 
 void QConsole::setPrompt(const QString& prompt)
 {
+    if (const auto session = m_server != nullptr ? m_server->current() : nullptr; session != nullptr) {
+        session->setPrompt(prompt.toStdString());
+        return;
+    }
+
     m_prompt = prompt.toStdString();
 }
 
+void QConsole::setBusyPrompt(const QString& prompt)
+{
+    m_busyPrompt = prompt.toStdString();
+}
+
 void QConsole::setDefaultPrompt(const QString& prompt)
 {
     m_defaultPrompt = prompt.toStdString();
@@ -346,6 +5762,11 @@ void QConsole::setDefaultPrompt(const QString& prompt)
 
 void QConsole::resetPrompt()
 {
+    if (const auto session = m_server != nullptr ? m_server->current() : nullptr; session != nullptr) {
+        session->setPrompt(m_defaultPrompt);
+        return;
+    }
+
     m_prompt = m_defaultPrompt;
 }
 
@@ -361,9 +5782,71 @@ const QString QConsole::defaultPrompt()
 
 const QString QConsole::prompt()
 {
+    if (const auto session = m_server != nullptr ? m_server->current() : nullptr; session != nullptr) {
+        return QString::fromStdString(session->prompt());
+    }
+
     return QString::fromStdString(m_prompt);
 }
 
+bool QConsole::listen(const QString& name)
+{
+    if (m_server == nullptr) {
+        m_server = new Server(this);
+    }
+
+    return m_server->listen(name);
+}
+
+void QConsole::stopListening()
+{
+    if (m_server != nullptr) {
+        m_server->close();
+    }
+}
+
+int QConsole::sessionCount() const
+{
+    return m_server != nullptr ? m_server->count() : 0;
+}
+
+void QConsole::setSharedHistory(bool shared)
+{
+    if (m_journal->shared() != shared) {
+        m_journal->setShared(shared);
+
+        if (!m_historyFilePath.empty()) {
+            setHistoryFilePath(QString::fromStdString(m_historyFilePath));
+        }
+    }
+}
+
+void QConsole::mergeHistory(bool reset, const std::vector<HistoryLine>& lines, bool terminal)
+{
+    if (reset) {
+        m_history->clear();
+    }
+
+    std::vector<std::string> texts;
+
+    if (terminal) {
+        texts.reserve(lines.size());
+    }
+
+    for (const auto& line : lines) {
+        if (terminal) {
+            texts.push_back(line.text);
+        }
+
+        m_history->add(line.text, line.timestamp);
+    }
+
+    // The terminal's history is only modified while no line is read, see "addTerminalHistory".
+    if (terminal && (reset || !texts.empty())) {
+        addTerminalHistory(reset, texts.data(), texts.size());
+    }
+}
+
 void QConsole::setHistoryFilePath(const QString& path)
 {
     if (QFileInfo fi(path); !fi.exists()) {
@@ -378,7 +5861,19 @@ void QConsole::setHistoryFilePath(const QString& path)
 
     m_historyFilePath = path.toStdString();
 
-    m_terminal->history_load(m_historyFilePath);
+    m_history->clear();
+
+    const auto lines = m_journal->open(path);
+
+    std::vector<std::string> texts;
+    texts.reserve(lines.size());
+
+    for (const auto& line : lines) {
+        texts.push_back(line.text);
+        m_history->add(line.text, line.timestamp);
+    }
+
+    addTerminalHistory(true, texts.data(), texts.size());
 }
 
 void QConsole::setStdinEcho(bool enable)
@@ -415,10 +5910,14 @@ void QConsole::setStdinEcho(bool enable)
 
 QByteArray QConsole::readLine(const QString& prompt)
 {
+    if (const auto session = m_server != nullptr ? m_server->current() : nullptr; session != nullptr) {
+        return session->readLine(prompt.toStdString(), true);
+    }
+
     QByteArray line;
     m_ostream << prompt;
 
-    m_ostream.flush();
+    flushOutput();
     QTextStream istream(stdin);
 
     istream >> line;
@@ -429,6 +5928,10 @@ QByteArray QConsole::readLine(const QString& prompt)
 
 QByteArray QConsole::readPass(const QString& prompt)
 {
+    if (const auto session = m_server != nullptr ? m_server->current() : nullptr; session != nullptr) {
+        return session->readLine(prompt.toStdString(), false);
+    }
+
     setStdinEcho(false);
     const auto pass = readLine(prompt);
     m_ostream << Qt::endl;
@@ -440,14 +5943,3 @@ QTextStream& QConsole::ostream()
 {
     return m_ostream;
 }
-
-const QConsole::Command* QConsole::findCommandByName(std::string_view name)
-{
-    const auto& iter = m_commands->longest_prefix(name);
-
-    if (iter != m_commands->end() && iter.key().length() == name.size()) {
-        return &iter.value();
-    }
-
-    return nullptr;
-}
@@ -23,9 +23,18 @@
 
 #pragma once
 
+#include <QtCore/QFuture>
 #include <QtCore/QObject>
 #include <QtCore/QString>
 #include <QtCore/QTextStream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+class QThreadPool;
 
 // QConsole is the access point to our REPL session and the terminal. It provides
 // the ability to add and remove invokable commands.
@@ -52,17 +61,286 @@ public:
         Bold   = 1
     };
 
+    // Buffering represents when the console output is written to its device.
+    enum class Buffering
+    {
+        Line   = 0, // Written as soon as a line is complete.
+        Block  = 1, // Written when the buffer is full.
+        Manual = 2  // Written by "flushOutput" only, or when the buffer is full.
+    };
+
+    // OutputStatistics counts what was written to the console output device.
+    struct OutputStatistics
+    {
+        // The number of bytes written.
+        quint64 bytes = 0;
+
+        // The number of writes made to the device, system calls when writing to stdout.
+        quint64 syscalls = 0;
+    };
+
+    // CommandMetrics holds the invocations of a command and their latency, in nanoseconds. The
+    // percentiles are within about 3% of the exact values.
+    struct CommandMetrics
+    {
+        QString name;
+        quint64 invocations = 0;
+
+        // The number of invocations that failed, returning a non-zero status or throwing.
+        quint64 errors = 0;
+
+        qint64 min  = 0;
+        qint64 mean = 0;
+        qint64 p50  = 0;
+        qint64 p90  = 0;
+        qint64 p99  = 0;
+        qint64 p999 = 0;
+        qint64 max  = 0;
+    };
+
+    // Arguments represents the arguments of a command. The arguments are UTF-8 views into the
+    // line being evaluated and they're only converted to QString on request. A copy of the list
+    // owns its arguments, so copy the list (or the context) to use it after the invocation.
+    class Arguments
+    {
+    public:
+        // Construct an empty list of arguments.
+        Arguments() = default;
+
+        // Construct a list of arguments from a list of strings.
+        Arguments(const QList<QString>& arguments);
+        Arguments(std::initializer_list<QString> arguments);
+
+        Arguments(const Arguments& other);
+        Arguments(Arguments&& other) noexcept;
+        Arguments& operator=(const Arguments& other);
+        Arguments& operator=(Arguments&& other) noexcept;
+
+        // Split a line into a list of arguments. Arguments are separated by whitespace, single
+        // quotes preserve the text between them, and double quotes do the same except for the
+        // escaped characters \" and \\. Outside of quotes, a backslash escapes any character.
+        // Return false if a quote isn't terminated.
+        static bool parse(std::string_view line, Arguments& arguments);
+
+        // Return the number of arguments.
+        qsizetype size() const;
+
+        // Check if there are no arguments.
+        bool isEmpty() const;
+
+        // Return the UTF-8 view of an argument.
+        std::string_view view(qsizetype i) const;
+
+        // Return an argument as a string.
+        QString at(qsizetype i) const;
+        QString operator[](qsizetype i) const;
+
+        // Return an argument as a string, or the default value if it's out of range.
+        QString value(qsizetype i, const QString& defaultValue = QString()) const;
+
+        // Return all the arguments joined by a separator.
+        QString join(const QString& separator) const;
+
+        // Return the arguments as a list of strings.
+        QList<QString> toList() const;
+        operator QList<QString>() const;
+
+        // Iterate over the UTF-8 views of the arguments.
+        const std::string_view* begin() const;
+        const std::string_view* end() const;
+
+    private:
+        friend class QConsole;
+
+        struct Storage
+        {
+            std::string                   buffer;
+            std::vector<std::string_view> views;
+        };
+
+        // Construct a list of arguments borrowing views owned by the console.
+        Arguments(const std::string_view* views, qsizetype size);
+
+        void assign(const std::string_view* views, qsizetype size);
+
+        std::unique_ptr<Storage> m_storage;
+        const std::string_view*  m_views = nullptr;
+        qsizetype                m_size  = 0;
+    };
+
     // Context represents a command execution environment.
     struct Context
     {
         // The arguments used to invoke the command.
-        const QList<QString> arguments;
+        const Arguments arguments;
+
+        // The output of the previous command of a pipeline, or nullptr. It's an in-memory
+        // buffer holding the whole output, which the next command reads in place.
+        QIODevice* input = nullptr;
+
+        // The output of the command: the input of the next command of a pipeline or a buffer
+        // capturing the output, or nullptr when the output goes to the console output.
+        QIODevice* output = nullptr;
+
+        // The console output stream, set by the console when it invokes the command.
+        QTextStream* console = nullptr;
+
+        // The stream writing to "output", or to the standard output without a console, created on
+        // first use and flushed after the invocation.
+        mutable std::shared_ptr<QTextStream> stream;
+
+        // Return the stream the command should write its output to: a stream writing to "output"
+        // if it's set, the console output stream otherwise, or the standard output if there's no
+        // console. Each invocation has its own stream, so output is captured without redirecting
+        // the output of the other invocations.
+        QTextStream& ostream() const;
+    };
+
+    // Callback wraps the function run when a command is invoked. The function returns the
+    // exit status of the command, 0 meaning success, or nothing if it always succeeds. A bool
+    // isn't accepted, since true would be taken for a failure.
+    class Callback
+    {
+    public:
+        Callback() = default;
+        Callback(std::nullptr_t) {}
+
+        template<typename F, typename = std::enable_if_t<std::is_invocable_v<F&, const Context&>>>
+        Callback(F function)
+        {
+            static_assert(!std::is_same_v<std::decay_t<std::invoke_result_t<F&, const Context&>>, bool>,
+                          "A command returns an exit status, 0 meaning success, not a bool");
+
+            if constexpr (std::is_void_v<std::invoke_result_t<F&, const Context&>>) {
+                m_function = [function = std::move(function)](const Context& ctx) mutable {
+                    function(ctx);
+                    return 0;
+                };
+            } else {
+                m_function = std::move(function);
+            }
+        }
+
+        int operator()(const Context& ctx) const
+        {
+            return m_function(ctx);
+        }
+
+        explicit operator bool() const
+        {
+            return static_cast<bool>(m_function);
+        }
+
+    private:
+        std::function<int(const Context& ctx)> m_function;
+    };
+
+    class Utf8Stream;
+
+    // Paint represents the color and the style of text written to a Utf8Stream: one of the basic
+    // colors, an index into the 256-color palette or a 24-bit color.
+    class Paint
+    {
+    public:
+        constexpr Paint(Color color, Style style = Style::Bold)
+          : Paint(Kind::Basic, static_cast<quint32>(color), style)
+        {
+        }
+
+        // Return the color of the given index of the 256-color palette.
+        static constexpr Paint palette(quint8 index, Style style = Style::Bold)
+        {
+            return Paint(Kind::Palette, index, style);
+        }
+
+        // Return a 24-bit color.
+        static constexpr Paint rgb(quint8 red, quint8 green, quint8 blue, Style style = Style::Bold)
+        {
+            return Paint(Kind::Rgb, (quint32(red) << 16) | (quint32(green) << 8) | blue, style);
+        }
+
+        // Return the paint resetting the color and the style of the text that follows.
+        static constexpr Paint reset()
+        {
+            return Paint(Kind::Reset, 0, Style::Normal);
+        }
+
+    private:
+        friend class Utf8Stream;
+
+        enum class Kind : quint8
+        {
+            Reset,
+            Basic,
+            Palette,
+            Rgb
+        };
+
+        constexpr Paint(Kind kind, quint32 value, Style style)
+          : m_kind(kind)
+          , m_style(style)
+          , m_value(value)
+        {
+        }
+
+        Kind    m_kind;
+        Style   m_style;
+        quint32 m_value;
+    };
+
+    // Utf8Stream writes UTF-8 text to the console output as it is, without the conversions of
+    // QTextStream. Its writes are ordered with the ones made to the output text stream.
+    class Utf8Stream
+    {
+    public:
+        Utf8Stream& operator<<(std::string_view text);
+        Utf8Stream& operator<<(const char* text);
+        Utf8Stream& operator<<(char c);
+        Utf8Stream& operator<<(const QByteArray& text);
+        Utf8Stream& operator<<(const QString& text);
+
+        // Write the escape sequence giving its color and style to the text that follows, unless
+        // colors are disabled (see "setNoColor") or stdout is written to and isn't a terminal.
+        Utf8Stream& operator<<(const Paint& paint);
+
+        template<typename T, typename = std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, char> &&
+                                                         !std::is_same_v<T, bool>>>
+        Utf8Stream& operator<<(T value)
+        {
+            if constexpr (std::is_signed_v<T>) {
+                return writeInteger(static_cast<qlonglong>(value));
+            } else {
+                return writeInteger(static_cast<qulonglong>(value));
+            }
+        }
+
+        // Write the text with the given color and style, then reset them.
+        template<typename T>
+        Utf8Stream& styled(const T& text, const Paint& paint)
+        {
+            return *this << paint << text << Paint::reset();
+        }
+
+        // Write the buffered output to the device.
+        void flush();
+
+    private:
+        friend class QConsole;
+
+        explicit Utf8Stream(QConsole* console);
+
+        Utf8Stream& writeInteger(qlonglong value);
+        Utf8Stream& writeInteger(qulonglong value);
+
+        QConsole* m_console;
     };
 
     // Command represents an invokable object.
     struct Command
     {
-        typedef std::function<void(const Context& ctx)> Callback;
+        typedef QConsole::Callback                                                             Callback;
+        typedef std::function<QFuture<void>(const Context& ctx)>                               AsyncCallback;
+        typedef std::function<QFuture<QList<QString>>(const Context& ctx, const QString& word)> CompleteCallback;
 
         // The name of the command.
         QString name;
@@ -72,44 +350,152 @@ public:
 
         // The callback to be run when the command is invoked.
         Callback invoke;
+
+        // The callback to be run instead of "invoke" when the command should run asynchronously.
+        // The prompt is given back while the returned future is pending (see "setBusyPrompt").
+        AsyncCallback invokeAsync;
+
+        // The callback returning the candidates for the argument being typed, the arguments
+        // before it are given by the context. It's called on the thread the console lives in
+        // and shouldn't block: the line keeps being edited while the returned future is
+        // pending, and the future is canceled as soon as the line changes.
+        CompleteCallback complete;
+
+        // How long the candidates returned by "complete" are cached, in milliseconds.
+        int completeCacheTime = 0;
     };
 
-    // Return a formatted string with the specified color and style.
-    static inline QString colorize(const QString& str, const Color& color, const Style& style = Style::Bold)
-    {
-        return QStringLiteral("\33[%1;3%2m%3\33[0m").arg(static_cast<int>(style)).arg(static_cast<int>(color)).arg(str);
-    }
+    // Return a formatted string with the specified color and style. Prefer "Utf8Stream::styled"
+    // to write styled text, which doesn't build a string.
+    static QString colorize(const QString& str, const Color& color, const Style& style = Style::Bold);
 
-    // Construct a new QConsole object. Note that you shouldn't create multiple instances of this
-    // class since that would result in unexpected behavior.
+    // Return an asynchronous callback that runs the specified callback on a thread pool. The
+    // global thread pool is used if no pool is specified. An exception thrown by the callback
+    // fails the command.
+    static Command::AsyncCallback runInThreadPool(Command::Callback callback, QThreadPool* pool = nullptr);
+
+    // Return a completion callback that runs the specified function on a thread pool. The
+    // global thread pool is used if no pool is specified.
+    static Command::CompleteCallback completeInThreadPool(
+      std::function<QList<QString>(const Context& ctx, const QString& word)> callback, QThreadPool* pool = nullptr);
+
+    // Construct a new QConsole object, with its own list of commands. Only one console at a time
+    // should read the terminal (see "start"), the other ones can be evaluated, run scripts or
+    // serve remote sessions.
     explicit QConsole(QObject* parent = nullptr);
 
     // Destroy the QConsole object.
     ~QConsole();
 
-    // Enable reading user input. This isn't a blocking method because the console will
-    // be activated after the main loop has been started.
+    // Create a session sharing the list of commands of this console: commands added to or
+    // removed from any of them are available to all of them. The prompt, the history, the active
+    // scopes, the terminal and the output are the session's own. The commands are read through
+    // immutable snapshots, so the sessions cost the memory of a single list and looking up a
+    // command never waits for a lock. The caller owns the session unless a parent is given.
+    QConsole* createSession(QObject* parent = nullptr);
+
+    // Enable reading user input. This isn't a blocking method: user input is read on a
+    // dedicated thread and every line is evaluated on the thread the console lives in, so
+    // its event loop keeps running while the prompt is idle. When the standard input isn't a
+    // terminal, nothing is read, unless the script mode is enabled (see "setScriptMode").
     void start();
 
-    // Disable reading user input after the current read is finished.
+    // Disable reading user input. The line being edited, if any, is discarded, and the
+    // script being run, if any, is stopped after the current line.
     void stop();
 
+    // Listen for remote sessions on a local socket, so that a process running without a terminal
+    // can be attached to, with "socat -,raw,echo=0 UNIX-CONNECT:<path>" for instance. Each session
+    // has its own prompt, line editor, history and output, and they share the commands. Their
+    // lines are evaluated one at a time on the thread the console lives in, asynchronous commands
+    // are waited for, and "exit" closes the session. Only the user running the process can
+    // connect. Return false if the server can't listen on the socket.
+    bool listen(const QString& name);
+
+    // Stop listening for remote sessions and close the ones connected.
+    void stopListening();
+
+    // Return the number of remote sessions connected.
+    int sessionCount() const;
+
+    // Evaluate the lines read from a device until its end and return 0 if they all succeeded,
+    // 1 otherwise. Blank lines and lines starting with '#' are skipped, and the lines aren't
+    // highlighted nor added to the history. Asynchronous commands are waited for.
+    int runScript(QIODevice* device);
+
+    // Set to false to keep running a script after a line failed. True by default.
+    void setStopOnError(bool stop);
+
+    // Set to true to have "start" run the standard input as a script when it isn't a terminal,
+    // like "app < commands.txt", then exit the application with the status of the script. False
+    // by default, so a service started without a terminal keeps running.
+    void setScriptMode(bool enabled);
+
     // Check if the console is currently reading user input.
     bool running();
 
-    // Add a new command to the list of available commands.
-    void addCommand(const Command& command);
+    // Add a new command to the list of available commands. When a scope is specified, the
+    // command is only available while the scope is active (see "pushScope").
+    void addCommand(const Command& command, const QString& scope = QString());
+    void addCommand(Command&& command, const QString& scope = QString());
+
+    // Add many commands at once, moving them into the list of available commands. Unlike
+    // "addCommand", this method keeps the list sealed and only rebuilds the index once.
+    void addCommands(QList<Command>&& commands, const QString& scope = QString());
 
     // Remove a command using its name.
-    void removeCommandByName(const QString& name);
+    void removeCommandByName(const QString& name, const QString& scope = QString());
 
-    // Return the number of commands currently available.
+    // Remove many commands at once using their names. Unlike "removeCommandByName", this method
+    // keeps the list sealed and only rebuilds the index once.
+    void removeCommands(const QList<QString>& names, const QString& scope = QString());
+
+    // Remove a scope and its commands, deactivating it if needed.
+    void removeScope(const QString& scope);
+
+    // Activate a scope on top of the active ones. Its commands become available and shadow
+    // the ones with the same name. Nothing is copied, so this takes constant time.
+    void pushScope(const QString& scope);
+
+    // Deactivate the scope that was activated last.
+    void popScope();
+
+    // Get the name of the scope that was activated last, or an empty string.
+    const QString currentScope();
+
+    // Return the number of commands currently available, including the shadowed ones.
     size_t commandCount();
 
+    // Seal the list of commands of every scope once it's final. Commands are then found with a
+    // perfect hash instead of the trie, completion and hints keep using the trie. Adding or
+    // removing a command unseals the list of its scope.
+    void seal();
+
+    // Check if the lists of available commands are sealed.
+    bool sealed();
+
+    // Return the completions of the input, the way the terminal completes them. The
+    // completions of an argument are empty until its completion callback has finished.
+    QList<QString> completions(const QString& input);
+
+    // Return the hint shown after the input, the way the terminal shows it, or an empty string.
+    QString hint(const QString& input);
+
     // Invoke a command using its name with the specified context. This method returns false
     // if the command wasn't found in the list of available commands.
     bool invokeCommandByName(const QString& name, const Context& ctx = Context{});
 
+    // Invoke a command using its name and capture its output, which is appended to the buffer
+    // as the command writes it. Asynchronous commands are waited for. Return the exit status of
+    // the command, or 127 if it wasn't found.
+    int invokeCommandByName(const QString& name, const Arguments& arguments, QByteArray& output);
+
+    // Evaluate a line without adding it to the history and return its exit status. Commands
+    // can be chained with ";", "&&" (if the previous one succeeded) and "||" (if it failed), and
+    // "|" pipes the output of a command to the input of the next one. The status is the one of
+    // the last command run, 127 if a command wasn't found, or 2 if the line is invalid.
+    int evaluate(const QString& line);
+
     // Reset the prompt to the default prompt value.
     void resetPrompt();
 
@@ -119,10 +505,20 @@ public:
     // Set the current prompt value.
     void setPrompt(const QString& prompt);
 
-    // Set the path to the history file.
+    // Set the text shown while an asynchronous command is running. When set, the prompt is
+    // given back once the command has finished. Otherwise, it's given back immediately.
+    void setBusyPrompt(const QString& prompt);
+
+    // Set the path to the history file and load it. Every evaluated line is appended to the
+    // file right away, which is compacted in the background as it grows.
     void setHistoryFilePath(const QString& path);
 
-    // Add the default commands: "help", "version", "exit", "history", and "clear".
+    // Set to true to share the history file with other sessions. The lines are appended under
+    // an advisory lock, and the ones appended by the other sessions are picked up when a line
+    // is evaluated or the history is navigated.
+    void setSharedHistory(bool shared);
+
+    // Add the default commands: "help", "version", "exit", "history", "stats", "trace", and "clear".
     void addDefaultCommands();
 
     // Set to false to hide user input in the terminal.
@@ -137,12 +533,63 @@ public:
     // Get the path to the history file.
     const QString historyFilePath();
 
-    // Read a line from stdin and return it as a byte array.
+    // Return the history entries containing the pattern, ignoring the case, from the newest to
+    // the oldest. All of them are returned if the limit is negative.
+    QList<QString> searchHistory(const QString& pattern, int limit = -1);
+
+    // Add a line to the history, and to the history file if any, as if it had been evaluated.
+    void addHistory(const QString& line);
+
+    // Read a line from stdin and return it as a byte array. While a line of a remote session is
+    // evaluated, the line is read from the session instead (see "listen").
     QByteArray readLine(const QString& prompt);
 
     // Same thing as "readLine" except the input is hidden from the user.
     QByteArray readPass(const QString& prompt);
 
+    // Return the metrics of the commands invoked so far, the most invoked first. This method
+    // is thread-safe.
+    QList<CommandMetrics> metrics() const;
+
+    // Return the metrics of the commands as a JSON document, for monitoring tools. This method
+    // is thread-safe.
+    QByteArray metricsJson() const;
+
+    // Forget the metrics recorded so far.
+    void resetMetrics();
+
+    // Set to true to record how long the line editor callbacks (hints, completion, highlighting
+    // and history navigation), the evaluated lines and the commands take. Each thread keeps its
+    // latest spans in its own ring buffer.
+    void setTracingEnabled(bool enabled);
+
+    // Return the recorded spans as a Chrome trace event document, which Perfetto and
+    // chrome://tracing open. This method is thread-safe.
+    QByteArray traceJson() const;
+
+    // Forget the spans recorded so far.
+    void clearTrace();
+
+    // Producer gives the next line of the output of a command, without its line break, and
+    // returns false once the output has ended. See "page".
+    typedef std::function<bool(std::string& line)> Producer;
+
+    // Write the lines given by the producer to the output of the command. When the pager is
+    // enabled and the command writes to the terminal, an output longer than the screen is shown
+    // a screen at a time, and lines are only asked for as they're scrolled to.
+    void page(const Context& ctx, const Producer& producer);
+
+    // Set to true to show long outputs in a pager, including the ones of "help" and "history".
+    // The arrows, Page Up, Page Down, Space, "g" and "G" scroll, "/" searches a pattern, "n" and
+    // "N" go to the next and previous matches, and "q" quits.
+    void setPagerEnabled(bool enabled);
+
+    // Print a line of text without breaking the line being edited. This method is thread-safe
+    // and lock-free, so it's the way to output text from asynchronous commands and other threads.
+    // Lines are queued and written in batches by the console thread. When too many lines are
+    // waiting to be written, new ones are dropped and reported.
+    void print(const QString& message);
+
     // The output text stream. This is a convenience object that can be used to provide
     // faster and more idiomatic access to stdout.
     QTextStream& ostream();
@@ -156,6 +603,12 @@ public:
     // Set the maximum number of completions to show before paginating.
     void setCompletionCountCutoff(int cutoff);
 
+    // Set the maximum number of completions. Command names are completed with a fuzzy match:
+    // the characters typed must appear in the name in the same order. Only the best matches are
+    // kept, ranking first names that start with the input, then matches at the start of words,
+    // and recently used commands.
+    void setCompletionLimit(int limit);
+
     // Set to true if auto-complete should require two tab presses.
     void setDoubleTabCompletion(bool complete);
 
@@ -168,36 +621,122 @@ public:
     // Set to true if color should be disabled.
     void setNoColor(bool color);
 
+    // The output stream writing UTF-8 text as it is, which saves the conversions of the output
+    // text stream when the text is already encoded.
+    Utf8Stream& utf8Stream();
+
     // Set the output device for the output text stream. This is useful if you want to
-    // write to a file or buffer instead of stdout.
+    // write to a file or buffer instead of stdout, which is written to again if the device is
+    // null. The previous device is left open. To capture the output of a single command, prefer
+    // "invokeCommandByName" with a buffer.
     void setOutputDevice(QIODevice* device);
 
+    // Set when the console output is written to its device. Output waits no longer than the
+    // maximum latency, in milliseconds, before being written; 0 means no limit. By default,
+    // lines are written as soon as they're complete.
+    void setOutputBuffering(Buffering buffering, int maxLatency = 50);
+
+    // Write the buffered console output to its device.
+    void flushOutput();
+
+    // Return the counters of the console output.
+    OutputStatistics outputStatistics() const;
+
     // Set to true to discard duplicate history items.
     void setUniqueHistory(bool unique);
 
-protected:
-    void timerEvent(QTimerEvent* event) override;
-
 private:
     Q_DISABLE_COPY(QConsole)
 
 private:
     class Terminal;
     class Trie;
-
-    Trie*     m_commands;
-    Terminal* m_terminal;
+    class Reader;
+    class MessageQueue;
+    class Index;
+    class Registry;
+    class Cursor;
+    class Completer;
+    class Journal;
+    class History;
+    struct HistoryLine;
+    struct Token;
+    class Output;
+    class Pager;
+    class Metrics;
+    class Tracer;
+    class Server;
+    class Session;
+    class Scopes;
+    class View;
+
+    QConsole(std::shared_ptr<Registry> registry, QObject* parent);
+
+    std::shared_ptr<Registry> m_registry;
+
+    Scopes*       m_scopes;
+    View*         m_view;
+    View*         m_terminalView;
+    Terminal*     m_terminal;
+    Reader*       m_reader;
+    MessageQueue* m_messages;
+    Cursor*       m_cursor;
+    Cursor*       m_hintCursor;
+    Completer*    m_completer;
+    Journal*      m_journal;
+    History*      m_history;
+    Output*       m_output;
+    Metrics*      m_metrics;
+    Tracer*       m_tracer;
+    Server*       m_server;
 
     std::string m_historyFilePath;
     std::string m_defaultPrompt;
     std::string m_prompt;
-
-    bool m_echo;
-    int  m_timerID;
-    bool m_running;
+    std::string m_busyPrompt;
+
+    // Reused by "evaluateLine" to avoid allocating memory for every line.
+    std::string                   m_line;
+    std::vector<Token>            m_tokens;
+    int                           m_depth;
+
+    // The lines waiting to be added to the terminal's history, after clearing it if requested,
+    // until no line is being read.
+    std::vector<std::string> m_terminalHistory;
+    bool                     m_terminalHistoryReset;
+
+    size_t m_completionLimit;
+
+    bool    m_echo;
+    bool    m_running;
+    bool    m_scripting;
+    bool    m_stopOnError;
+    bool    m_scriptMode;
+    bool    m_waiting;
+    bool    m_stdout;
+    bool    m_noColor;
+    bool    m_pager;
+    quint64 m_generation;
 
     QTextStream m_ostream;
-
-    const Command* findCommandByName(std::string_view name);
-    void           evaluateLine(const char* line);
+    Utf8Stream  m_utf8;
+
+    bool           colored() const;
+    bool           colored(const Context& ctx) const;
+    void           printError(QTextStream& out, std::string_view message, bool colors);
+    bool           evaluateLine(std::string_view line);
+    void           appendHistory(std::string_view line);
+    void           addTerminalHistory(bool reset, const std::string* lines, size_t count);
+    void           applyTerminalHistory();
+    int            execute(const std::vector<Token>& tokens, bool interactive, QTextStream& out);
+    int            pipeline(const Token* tokens, size_t count, bool alone, QTextStream& out);
+    int            invokeCommand(std::string_view name, const std::string_view* arguments, qsizetype count,
+                                 QIODevice* input, QIODevice* output, bool alone, QTextStream& out);
+    void           readNextLine();
+    void           invokeAsync(const Command& command, const Context& ctx, bool wait);
+    void           drainMessages();
+    QList<QString> completeArgument(std::string_view line, View& view);
+    void           mergeHistory(bool reset, const std::vector<HistoryLine>& lines, bool terminal);
+    void           requestCompletions(quint64 request, const QByteArray& key, const QString& name, const QString& word,
+                                      const Context& ctx);
 };
@@ -0,0 +1,113 @@
+// Copyright (c) 2021 Leonardo da Vinci
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// pty-console is the console driven by the terminal tests through a pseudo-terminal. It has the
+// default commands, "hello-world", "connect" completing its argument, "numbers" paging as many
+// lines as asked for, and the generated commands "command-<n>" given by "--commands", with a
+// plain prompt to match the output easily.
+
+#include <QConsole>
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QCoreApplication>
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addOptions({
+      { "commands", "Number of generated commands.", "count", "0" },
+      { "history", "Path to the history file.", "path" },
+      { "pager", "Enable the pager." },
+    });
+    parser.process(app);
+
+    QConsole console;
+    console.addDefaultCommands();
+    console.setDefaultPrompt("pty> ");
+
+    // The completions fit on a screen, the line editor would ask before listing more.
+    console.setCompletionLimit(16);
+
+    if (parser.isSet("history")) {
+        console.setHistoryFilePath(parser.value("history"));
+    }
+
+    console.setPagerEnabled(parser.isSet("pager"));
+
+    console.addCommand({
+      "hello-world",
+      "Print 'Hello, world!' and arguments.",
+      [](const QConsole::Context& ctx) {
+          ctx.ostream() << "Hello, World! Arguments: " << ctx.arguments.join(" ") << Qt::endl;
+      },
+    });
+
+    console.addCommand({
+      "connect",
+      "Connect to a host.",
+      [](const QConsole::Context& ctx) { ctx.ostream() << "Connected to " << ctx.arguments.value(0) << Qt::endl; },
+      nullptr,
+      QConsole::completeInThreadPool([](const QConsole::Context& ctx, const QString& word) {
+          Q_UNUSED(ctx)
+          Q_UNUSED(word)
+          return QList<QString>({ "localhost", "example.com" });
+      }),
+    });
+
+    // The number of lines the pager asked for is printed once it's closed.
+    console.addCommand({
+      "numbers",
+      "Page the given number of lines.",
+      [&console](const QConsole::Context& ctx) {
+          const auto count    = ctx.arguments.value(0).toInt();
+          int        produced = 0;
+
+          console.page(ctx, [&](std::string& line) {
+              if (produced == count) {
+                  return false;
+              }
+
+              line.append("number ").append(std::to_string(++produced));
+              return true;
+          });
+
+          ctx.ostream() << "produced " << produced << Qt::endl;
+      },
+    });
+
+    QList<QConsole::Command> commands;
+
+    for (int i = 0, count = parser.value("commands").toInt(); i < count; ++i) {
+        commands.append({
+          QStringLiteral("command-%1").arg(i),
+          "Generated command.",
+          [](const QConsole::Context& ctx) { Q_UNUSED(ctx) },
+        });
+    }
+
+    console.addCommands(std::move(commands));
+    console.start();
+
+    return app.exec();
+}
@@ -0,0 +1,269 @@
+// Copyright (c) 2021 Leonardo da Vinci
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "pty-harness.h"
+
+#include <QtCore/QElapsedTimer>
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <pty.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+extern char** environ;
+
+// Return a monotonic timestamp in nanoseconds.
+static qint64 now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<qint64>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+PtyHarness::~PtyHarness()
+{
+    stop(0);
+}
+
+bool PtyHarness::start(const QString& program, const QStringList& arguments, int columns, int rows)
+{
+    // The arguments are converted before forking, the child only calls async-signal-safe functions.
+    std::vector<QByteArray> strings{ program.toLocal8Bit() };
+
+    for (const auto& argument : arguments) {
+        strings.push_back(argument.toLocal8Bit());
+    }
+
+    std::vector<char*> argv;
+
+    for (auto& string : strings) {
+        argv.push_back(string.data());
+    }
+
+    argv.push_back(nullptr);
+
+    // The line editor falls back to a plain prompt on terminals it doesn't know.
+    std::vector<char*> envp;
+
+    for (auto variable = environ; *variable != nullptr; ++variable) {
+        if (strncmp(*variable, "TERM=", 5) != 0) {
+            envp.push_back(*variable);
+        }
+    }
+
+    envp.push_back(const_cast<char*>("TERM=xterm-256color"));
+    envp.push_back(nullptr);
+
+    struct winsize size = {};
+    size.ws_col         = static_cast<unsigned short>(columns);
+    size.ws_row         = static_cast<unsigned short>(rows);
+
+    m_pid = forkpty(&m_master, nullptr, nullptr, &size);
+
+    if (m_pid < 0) {
+        return false;
+    }
+
+    if (m_pid == 0) {
+        execve(argv[0], argv.data(), envp.data());
+        _exit(127);
+    }
+
+    m_pending.clear();
+    m_screen.clear();
+    m_output.clear();
+    m_sent = now();
+
+    return true;
+}
+
+int PtyHarness::stop(int timeout)
+{
+    if (m_pid <= 0) {
+        return -1;
+    }
+
+    int           status = 0;
+    QElapsedTimer timer;
+    timer.start();
+
+    // The output is drained meanwhile, a program blocked on writing to the terminal can't exit.
+    while (waitpid(m_pid, &status, WNOHANG) == 0) {
+        if (timer.elapsed() >= timeout) {
+            kill(m_pid, SIGKILL);
+            waitpid(m_pid, &status, 0);
+            break;
+        }
+
+        read(10);
+    }
+
+    close(m_master);
+    m_pid    = -1;
+    m_master = -1;
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void PtyHarness::send(const QByteArray& keys)
+{
+    // Whatever was drawn before belongs to the previous keys.
+    while (read(0) > 0) {
+    }
+
+    m_screen.clear();
+    m_output.clear();
+    m_sent = now();
+
+    for (qsizetype written = 0; written < keys.size();) {
+        const auto n = ::write(m_master, keys.constData() + written, static_cast<size_t>(keys.size() - written));
+
+        if (n < 0 && errno != EINTR) {
+            return;
+        }
+
+        written += n < 0 ? 0 : n;
+    }
+}
+
+qint64 PtyHarness::waitFor(const QByteArray& text, int timeout)
+{
+    const auto deadline = m_sent + static_cast<qint64>(timeout) * 1000000;
+
+    while (!m_screen.contains(text)) {
+        const auto remaining = (deadline - now()) / 1000000;
+
+        if (remaining < 0 || read(static_cast<int>(remaining)) < 0) {
+            return -1;
+        }
+    }
+
+    return now() - m_sent;
+}
+
+qint64 PtyHarness::keystroke(const QByteArray& keys, const QByteArray& text, int timeout)
+{
+    send(keys);
+    return waitFor(text, timeout);
+}
+
+qint64 PtyHarness::waitForRedraw(int quiet, int timeout)
+{
+    const auto deadline = m_sent + static_cast<qint64>(timeout) * 1000000;
+
+    while (now() < deadline) {
+        const auto n = read(m_drawn > m_sent ? quiet : 1);
+
+        if (n < 0) {
+            return -1;
+        }
+
+        if (n == 0 && m_drawn > m_sent) {
+            return m_drawn - m_sent;
+        }
+    }
+
+    return -1;
+}
+
+const QByteArray& PtyHarness::screen() const
+{
+    return m_screen;
+}
+
+const QByteArray& PtyHarness::output() const
+{
+    return m_output;
+}
+
+qsizetype PtyHarness::read(int timeout)
+{
+    struct pollfd fd = { m_master, POLLIN, 0 };
+
+    if (const auto ready = poll(&fd, 1, timeout); ready <= 0) {
+        return ready < 0 && errno != EINTR ? -1 : 0;
+    }
+
+    char       buffer[4096];
+    const auto n = ::read(m_master, buffer, sizeof(buffer));
+
+    // Reading the master fails with EIO once the slave side is closed.
+    if (n <= 0) {
+        return -1;
+    }
+
+    m_drawn = now();
+    m_pending.append(buffer, n);
+    m_output.append(buffer, n);
+
+    // Strip the escape sequences, a sequence split across reads is kept until it's complete.
+    qsizetype i = 0;
+
+    while (i < m_pending.size()) {
+        const char c = m_pending.at(i);
+
+        if (c != '\x1b') {
+            if (c != '\r') {
+                m_screen.append(c);
+            }
+
+            i++;
+            continue;
+        }
+
+        if (i + 1 >= m_pending.size()) {
+            break;
+        }
+
+        qsizetype end = i + 2;
+
+        if (m_pending.at(i + 1) == '[') {
+            while (end < m_pending.size() && (m_pending.at(end) < 0x40 || m_pending.at(end) > 0x7e)) {
+                end++;
+            }
+
+            if (end >= m_pending.size()) {
+                break;
+            }
+
+            // The line editor may ask where the cursor is, a real terminal would answer.
+            if (m_pending.mid(i, end - i + 1) == "\x1b[6n") {
+                static const char           answer[] = "\x1b[1;1R";
+                [[maybe_unused]] const auto written  = ::write(m_master, answer, sizeof(answer) - 1);
+            }
+
+            end++;
+        }
+
+        i = end;
+    }
+
+    m_pending.remove(0, i);
+
+    return n;
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2021 Leonardo da Vinci
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <QtCore/QByteArray>
+#include <QtCore/QStringList>
+
+#include <sys/types.h>
+
+// PtyHarness runs a program on the slave side of a pseudo-terminal, like a user's terminal
+// emulator would, so that the console reads its input in raw mode and redraws the line being
+// edited. Keystrokes are written to the master side and the time until the expected text is
+// drawn is measured.
+class PtyHarness
+{
+public:
+    PtyHarness() = default;
+    ~PtyHarness();
+
+    PtyHarness(const PtyHarness&) = delete;
+    PtyHarness& operator=(const PtyHarness&) = delete;
+
+    // Start the program with a terminal of the given size. Return false if it couldn't be started.
+    bool start(const QString& program, const QStringList& arguments, int columns = 80, int rows = 24);
+
+    // Stop the program, killing it if it doesn't exit on its own, and return its exit status.
+    int stop(int timeout = 1000);
+
+    // Write the keys as if they were typed. The output drawn so far is forgotten.
+    void send(const QByteArray& keys);
+
+    // Wait until the text has been drawn since the keys were last sent, escape sequences aside.
+    // Return the number of nanoseconds since the keys were sent, or -1 on timeout.
+    qint64 waitFor(const QByteArray& text, int timeout = 2000);
+
+    // Send the keys and wait until the text has been drawn, see "waitFor".
+    qint64 keystroke(const QByteArray& keys, const QByteArray& text, int timeout = 2000);
+
+    // Wait until the terminal has been quiet for the given milliseconds after drawing something
+    // since the keys were last sent. Return the number of nanoseconds from the keys to the last
+    // byte drawn, or -1 on timeout.
+    qint64 waitForRedraw(int quiet = 5, int timeout = 2000);
+
+    // Return the text drawn since the keys were last sent, without the escape sequences.
+    const QByteArray& screen() const;
+
+    // Return the bytes drawn since the keys were last sent, escape sequences included.
+    const QByteArray& output() const;
+
+private:
+    // Read what's available within the timeout, answering the cursor position requests. Return
+    // the number of bytes read, or -1 once the program is gone.
+    qsizetype read(int timeout);
+
+    pid_t      m_pid    = -1;
+    int        m_master = -1;
+    qint64     m_sent   = 0;
+    qint64     m_drawn  = 0;
+    QByteArray m_pending;
+    QByteArray m_screen;
+    QByteArray m_output;
+};
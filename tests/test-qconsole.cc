@@ -24,8 +24,11 @@
 #include "test-qconsole.h"
 
 #include <QConsole>
+#include <QtNetwork/QLocalSocket>
 #include <QtTest/QtTest>
 
+#include <stdexcept>
+
 void QConsoleTester::populateTest()
 {
     QConsole console;
@@ -66,6 +69,34 @@ void QConsoleTester::populateBenchmark()
     }
 }
 
+void QConsoleTester::populateBulkBenchmark()
+{
+    QConsole console;
+
+    QList<QString> names;
+
+    for (int i = 0; i < 10000; ++i) {
+        names.append(QString::number(i));
+    }
+
+    QBENCHMARK
+    {
+        QList<QConsole::Command> commands;
+        commands.reserve(names.size());
+
+        for (const auto& name : names) {
+            commands.append({
+              name,
+              "Random description...",
+              [](const QConsole::Context& ctx) { Q_UNUSED(ctx) },
+            });
+        }
+
+        console.addCommands(std::move(commands));
+        console.removeCommands(names);
+    }
+}
+
 void QConsoleTester::colorizeTest()
 {
     QVERIFY(QConsole::colorize("Test", QConsole::Color::Cyan, QConsole::Style::Normal) == "\33[0;36mTest\33[0m");
@@ -111,8 +142,24 @@ void QConsoleTester::unicodeTest()
     QVERIFY(check == false);
 }
 
+void QConsoleTester::evaluateBenchmark_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<bool>("sealed");
+
+    QTest::newRow("1k") << 1000 << false;
+    QTest::newRow("1k-sealed") << 1000 << true;
+    QTest::newRow("10k") << 10000 << false;
+    QTest::newRow("10k-sealed") << 10000 << true;
+    QTest::newRow("100k") << 100000 << false;
+    QTest::newRow("100k-sealed") << 100000 << true;
+}
+
 void QConsoleTester::evaluateBenchmark()
 {
+    QFETCH(int, count);
+    QFETCH(bool, sealed);
+
     QConsole console;
 
     QBuffer buffer;
@@ -120,7 +167,7 @@ void QConsoleTester::evaluateBenchmark()
 
     console.setOutputDevice(&buffer);
 
-    for (int i = 0; i < 1000; ++i) {
+    for (int i = 0; i < count; ++i) {
         console.addCommand({
           QString::number(i),
           "Random description...",
@@ -128,9 +175,12 @@ void QConsoleTester::evaluateBenchmark()
         });
     }
 
-    console.addCommand({
+    const auto name = QStringLiteral(
       "long-random-value-command-name-long-random-value-command-name-long-random-value-command-name-long-random-value-"
-      "command-name",
+      "command-name");
+
+    console.addCommand({
+      name,
       "Random description...",
       [](const QConsole::Context& ctx) {
           Q_UNUSED(ctx)
@@ -139,15 +189,1020 @@ void QConsoleTester::evaluateBenchmark()
       },
     });
 
+    if (sealed) {
+        console.seal();
+        QVERIFY(console.sealed());
+    }
+
+    QList<QString> names;
+
+    for (int i = 0; i < 10000; ++i) {
+        names.append(QString::number((i * 7919) % count));
+    }
+
     QBENCHMARK
     {
-        for (int i = 0; i < 10000; ++i) {
-            console.invokeCommandByName("long-random-value-command-name-long-random-value-command-name-long-random-"
-                                        "value-command-name-long-random-value-command-name");
+        for (const auto& n : names) {
+            console.invokeCommandByName(name);
+            console.invokeCommandByName(n);
         }
     }
 }
 
+void QConsoleTester::sealTest()
+{
+    QConsole console;
+
+    int check = -1;
+
+    for (int i = 0; i < 1000; ++i) {
+        console.addCommand({
+          QString::number(i),
+          "Random description...",
+          [&check, i](const QConsole::Context& ctx) {
+              Q_UNUSED(ctx)
+              check = i;
+          },
+        });
+    }
+
+    console.seal();
+    QVERIFY(console.sealed());
+
+    for (int i = 0; i < 1000; ++i) {
+        QVERIFY(console.invokeCommandByName(QString::number(i)));
+        QVERIFY(check == i);
+    }
+
+    QVERIFY(!console.invokeCommandByName("1000"));
+    QVERIFY(!console.invokeCommandByName(""));
+
+    console.removeCommandByName("0");
+    QVERIFY(!console.sealed());
+    QVERIFY(!console.invokeCommandByName("0"));
+    QVERIFY(console.invokeCommandByName("1"));
+}
+
+void QConsoleTester::asyncTest()
+{
+    QConsole console;
+
+    std::atomic<int> check = -1;
+
+    console.addCommand({
+      "async",
+      "Random description...",
+      nullptr,
+      QConsole::runInThreadPool([&check](const QConsole::Context& ctx) { check = ctx.arguments.size(); }),
+    });
+
+    QVERIFY(console.invokeCommandByName("async", QConsole::Context{ { "a", "b" } }));
+    QTRY_VERIFY(check == 2);
+
+    // An exception fails the command instead of leaving it running.
+    QBuffer buffer;
+    buffer.open(QBuffer::WriteOnly);
+
+    console.setOutputDevice(&buffer);
+    console.addCommand({
+      "throw",
+      "Random description...",
+      nullptr,
+      QConsole::runInThreadPool([](const QConsole::Context&) -> int { throw std::runtime_error("Random error"); }),
+    });
+
+    QVERIFY(console.invokeCommandByName("throw"));
+    QTRY_VERIFY(buffer.data().contains("Command failed: Random error"));
+}
+
+void QConsoleTester::printTest()
+{
+    QConsole console;
+
+    QBuffer buffer;
+    buffer.open(QBuffer::WriteOnly);
+
+    console.setOutputDevice(&buffer);
+    console.print("first");
+
+    QVERIFY(buffer.data() == "first\n");
+
+    QThreadPool pool;
+
+    for (int i = 0; i < 8; ++i) {
+        pool.start([&console]() {
+            for (int j = 0; j < 100; ++j) {
+                console.print(QString::number(j));
+            }
+        });
+    }
+
+    pool.waitForDone();
+
+    QTRY_VERIFY(buffer.data().count('\n') == 801);
+}
+
+void QConsoleTester::argumentsTest()
+{
+    QConsole::Arguments arguments;
+
+    QVERIFY(QConsole::Arguments::parse("  cmd   a  b ", arguments));
+    QVERIFY(arguments.toList() == QList<QString>({ "cmd", "a", "b" }));
+
+    QVERIFY(QConsole::Arguments::parse(R"(cmd "a b" 'c d' e\ f "\"\\" '')", arguments));
+    QVERIFY(arguments.toList() == QList<QString>({ "cmd", "a b", "c d", "e f", "\"\\", "" }));
+
+    QVERIFY(!QConsole::Arguments::parse("cmd 'unterminated", arguments));
+
+    QVERIFY(QConsole::Arguments::parse("ā 'ă ą'", arguments));
+    QVERIFY(arguments.size() == 2);
+    QVERIFY(arguments.view(1) == "ă ą");
+    QVERIFY(arguments.at(1) == "ă ą");
+    QVERIFY(arguments.value(2, "default") == "default");
+
+    const auto copy = arguments;
+    QVERIFY(copy.join(",") == "ā,ă ą");
+}
+
+void QConsoleTester::bulkTest()
+{
+    QConsole console;
+
+    QList<QConsole::Command> commands;
+    QList<QString>           names;
+
+    for (int i = 0; i < 100; ++i) {
+        names.append(QString::number(i));
+        commands.append({
+          names.last(),
+          "Random description...",
+          [](const QConsole::Context& ctx) { Q_UNUSED(ctx) },
+        });
+    }
+
+    console.seal();
+    console.addCommands(std::move(commands));
+
+    QVERIFY(console.commandCount() == 100);
+    QVERIFY(console.sealed());
+    QVERIFY(console.invokeCommandByName("42"));
+
+    console.removeCommands(names.mid(50));
+
+    QVERIFY(console.commandCount() == 50);
+    QVERIFY(console.sealed());
+    QVERIFY(console.invokeCommandByName("42"));
+    QVERIFY(!console.invokeCommandByName("51"));
+}
+
+void QConsoleTester::scopeTest()
+{
+    QConsole console;
+
+    QString check;
+
+    console.addCommand({
+      "ping",
+      "Random description...",
+      [&check](const QConsole::Context& ctx) {
+          Q_UNUSED(ctx)
+          check = "global";
+      },
+    });
+
+    console.addCommand(
+      {
+        "ping",
+        "Random description...",
+        [&check](const QConsole::Context& ctx) {
+            Q_UNUSED(ctx)
+            check = "online";
+        },
+      },
+      "online");
+
+    console.addCommand(
+      {
+        "logout",
+        "Random description...",
+        [](const QConsole::Context& ctx) { Q_UNUSED(ctx) },
+      },
+      "online");
+
+    QVERIFY(console.commandCount() == 1);
+    QVERIFY(!console.invokeCommandByName("logout"));
+    QVERIFY(console.invokeCommandByName("ping"));
+    QVERIFY(check == "global");
+
+    console.pushScope("online");
+
+    QVERIFY(console.currentScope() == "online");
+    QVERIFY(console.commandCount() == 3);
+    QVERIFY(console.invokeCommandByName("logout"));
+    QVERIFY(console.invokeCommandByName("ping"));
+    QVERIFY(check == "online");
+
+    console.popScope();
+
+    QVERIFY(console.currentScope().isEmpty());
+    QVERIFY(!console.invokeCommandByName("logout"));
+    QVERIFY(console.invokeCommandByName("ping"));
+    QVERIFY(check == "global");
+
+    console.pushScope("online");
+    console.removeScope("online");
+
+    QVERIFY(console.currentScope().isEmpty());
+    QVERIFY(console.commandCount() == 1);
+}
+
+void QConsoleTester::completionTest()
+{
+    QConsole console;
+
+    for (const auto& name : { "git-commit", "gitk", "grep", "getConfig", "commit" }) {
+        console.addCommand({
+          name,
+          "Random description...",
+          [](const QConsole::Context& ctx) { Q_UNUSED(ctx) },
+        });
+    }
+
+    QVERIFY(console.completions("git") == QList<QString>({ "gitk", "git-commit" }));
+    QVERIFY(console.completions("gc") == QList<QString>({ "getConfig", "git-commit" }));
+    QVERIFY(console.completions("zzz").isEmpty());
+
+    QVERIFY(console.hint("gi") == "git-commit");
+    QVERIFY(console.hint("gitk") == "gitk");
+    QVERIFY(console.hint("gr") == "grep");
+    QVERIFY(console.hint("zzz").isEmpty());
+    QVERIFY(console.hint("git ").isEmpty());
+
+    console.setCompletionLimit(2);
+    QVERIFY(console.completions("").size() == 2);
+
+    console.setCompletionLimit(100);
+    QVERIFY(console.completions("").size() == 5);
+}
+
+void QConsoleTester::hintTest()
+{
+    QConsole console;
+
+    for (const auto& name : { "git-commit", "gitk", "grep", "getConfig" }) {
+        console.addCommand({
+          name,
+          "Random description...",
+          [](const QConsole::Context& ctx) { Q_UNUSED(ctx) },
+        });
+    }
+
+    // Every keystroke narrows the hint down.
+    QVERIFY(console.hint("g") == "getConfig");
+    QVERIFY(console.hint("gi") == "git-commit");
+    QVERIFY(console.hint("gitk") == "gitk");
+    QVERIFY(console.hint("gitkx").isEmpty());
+
+    // Backspacing widens it again.
+    QVERIFY(console.hint("gitk") == "gitk");
+    QVERIFY(console.hint("gi") == "git-commit");
+    QVERIFY(console.hint("g") == "getConfig");
+    QVERIFY(console.hint("gr") == "grep");
+
+    // The commands added or removed since the last keystroke are hinted, even for the same word.
+    QVERIFY(console.hint("git") == "git-commit");
+    console.addCommand({
+      "git",
+      "Random description...",
+      [](const QConsole::Context& ctx) { Q_UNUSED(ctx) },
+    });
+    QVERIFY(console.hint("git") == "git");
+
+    console.removeCommandByName("git");
+    QVERIFY(console.hint("git") == "git-commit");
+
+    // The topmost scope is hinted first.
+    console.addCommand(
+      {
+        "gist",
+        "Random description...",
+        [](const QConsole::Context& ctx) { Q_UNUSED(ctx) },
+      },
+      "remote");
+    QVERIFY(console.hint("gi") == "git-commit");
+
+    console.pushScope("remote");
+    QVERIFY(console.hint("gi") == "gist");
+    QVERIFY(console.hint("git") == "git-commit");
+
+    console.popScope();
+    QVERIFY(console.hint("gis").isEmpty());
+}
+
+void QConsoleTester::argumentCompletionTest()
+{
+    QConsole         console;
+    std::atomic<int> calls = 0;
+
+    QConsole::Command command{
+        "connect",
+        "Random description...",
+        [](const QConsole::Context& ctx) { Q_UNUSED(ctx) },
+    };
+
+    command.complete = QConsole::completeInThreadPool([&calls](const QConsole::Context& ctx, const QString& word) {
+        Q_UNUSED(word)
+        calls++;
+        return ctx.arguments.isEmpty() ? QList<QString>({ "alpha", "beta", "bravo" }) : QList<QString>({ "80", "443" });
+    });
+    command.completeCacheTime = 60000;
+
+    console.addCommand(std::move(command));
+
+    // The candidates aren't known until the callback has finished.
+    QVERIFY(console.completions("connect b").isEmpty());
+    QTRY_VERIFY(console.completions("connect b") == QList<QString>({ "beta", "bravo" }));
+
+    // A longer word is completed from the cache.
+    QVERIFY(console.completions("connect br") == QList<QString>({ "bravo" }));
+    QVERIFY(calls == 1);
+
+    QTRY_VERIFY(console.completions("connect beta 4") == QList<QString>({ "443" }));
+    QVERIFY(calls == 2);
+
+    QVERIFY(console.completions("unknown a").isEmpty());
+}
+
+void QConsoleTester::historyTest()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    const auto path = dir.filePath("history");
+
+    {
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write("### 2021-05-02 10:00:00.000\nfirst\n### 2021-05-02 10:00:01.000\nsecond\r\nthird\n");
+    }
+
+    QConsole console;
+
+    QBuffer buffer;
+    buffer.open(QBuffer::WriteOnly);
+
+    console.setOutputDevice(&buffer);
+    console.addDefaultCommands();
+    console.setHistoryFilePath(path);
+    console.invokeCommandByName("history");
+
+    const auto output = QString::fromUtf8(buffer.data());
+
+    // The timestamps of the file are kept.
+    QVERIFY(output.contains(" 2021-05-02 10:00:00.000 first\n"));
+    QVERIFY(output.contains(" 2021-05-02 10:00:01.000 second\n"));
+    QVERIFY(output.contains(" third\n"));
+    QVERIFY(!output.contains("###"));
+
+    // The lines evaluated afterwards are appended after their timestamp.
+    console.addHistory("fourth");
+    console.setHistoryFilePath(path);
+
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+
+    const auto lines = file.readAll().split('\n');
+    QVERIFY(lines.size() > 3 && lines[lines.size() - 2] == "fourth" && lines[lines.size() - 3].startsWith("### 20"));
+
+    buffer.buffer().clear();
+    buffer.seek(0);
+    console.invokeCommandByName("history");
+    QVERIFY(QString::fromUtf8(buffer.data()).contains(" 2021-05-02 10:00:01.000 second\n"));
+}
+
+void QConsoleTester::historySearchTest()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    const auto path = dir.filePath("history");
+
+    {
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write("git status\nls -la\ngit commit -m 'Fix'\nmake\nGit push\nls -la\n");
+    }
+
+    QConsole console;
+
+    QBuffer buffer;
+    buffer.open(QBuffer::WriteOnly);
+
+    console.setOutputDevice(&buffer);
+    console.addDefaultCommands();
+    console.setHistoryFilePath(path);
+
+    QVERIFY(console.searchHistory("git") == QList<QString>({ "Git push", "git commit -m 'Fix'", "git status" }));
+    QVERIFY(console.searchHistory("git", 1) == QList<QString>({ "Git push" }));
+    QVERIFY(console.searchHistory("s") == QList<QString>({ "ls -la", "Git push", "git status" }));
+    QVERIFY(console.searchHistory("ls").size() == 1);
+    QVERIFY(console.searchHistory("svn").isEmpty());
+    QVERIFY(console.searchHistory("").size() == 5);
+
+    console.addHistory("  svn update ");
+    console.addHistory("");
+    QVERIFY(console.searchHistory("svn") == QList<QString>({ "svn update" }));
+    QVERIFY(console.searchHistory("").size() == 6);
+
+    console.invokeCommandByName("history", { { "git", "--last", "1", "--page", "2" } });
+
+    const auto output = QString::fromUtf8(buffer.data());
+
+    QVERIFY(output.contains(" git commit -m 'Fix'\n"));
+    QVERIFY(!output.contains("Git push"));
+    QVERIFY(!output.contains("git status"));
+}
+
+void QConsoleTester::sharedHistoryTest()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    const auto path = dir.filePath("history");
+
+    {
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write("first\n");
+    }
+
+    QConsole console;
+
+    QBuffer buffer;
+    buffer.open(QBuffer::WriteOnly);
+
+    console.setOutputDevice(&buffer);
+    console.addDefaultCommands();
+    console.setSharedHistory(true);
+    console.setHistoryFilePath(path);
+
+    QVERIFY(console.searchHistory("") == QList<QString>({ "first" }));
+
+    // Another session appends a line.
+    {
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Append));
+        file.write("second\n");
+    }
+
+    console.invokeCommandByName("history");
+    QVERIFY(console.searchHistory("") == QList<QString>({ "second", "first" }));
+
+    // Another session compacts the file.
+    {
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+        file.write("### qconsole 1\nthird\nfourth\nfifth\n");
+    }
+
+    console.invokeCommandByName("history");
+    QVERIFY(console.searchHistory("") == QList<QString>({ "fifth", "fourth", "third" }));
+}
+
+void QConsoleTester::scriptTest()
+{
+    QConsole    console;
+    QStringList sums;
+
+    QBuffer output;
+    output.open(QBuffer::WriteOnly);
+
+    console.setOutputDevice(&output);
+    console.addCommand({
+      "sum",
+      "Random description...",
+      [&sums](const QConsole::Context& ctx) {
+          int sum = 0;
+
+          for (const auto arg : ctx.arguments) {
+              sum += QString::fromUtf8(arg.data(), static_cast<qsizetype>(arg.size())).toInt();
+          }
+
+          sums.append(QString::number(sum));
+      },
+    });
+
+    QByteArray script("# Comment\n\nsum 1 2\r\n  sum 'a b' 3\nunknown\nsum 4 \"5\"");
+
+    QBuffer input(&script);
+    input.open(QBuffer::ReadOnly);
+
+    QCOMPARE(console.runScript(&input), 1);
+    QCOMPARE(sums, QStringList({ "3", "3" }));
+
+    sums.clear();
+    input.seek(0);
+    console.setStopOnError(false);
+
+    QCOMPARE(console.runScript(&input), 1);
+    QCOMPARE(sums, QStringList({ "3", "3", "9" }));
+
+    // Lines spanning blocks.
+    script.clear();
+
+    for (int i = 0; i < 50000; ++i) {
+        script.append("sum 1 ").append(QByteArray::number(i)).append('\n');
+    }
+
+    sums.clear();
+    input.close();
+    input.open(QBuffer::ReadOnly);
+
+    QCOMPARE(console.runScript(&input), 0);
+    QCOMPARE(sums.size(), 50000);
+    QCOMPARE(sums.last(), QStringLiteral("50000"));
+}
+
+void QConsoleTester::chainTest()
+{
+    QConsole    console;
+    QStringList calls;
+
+    QBuffer output;
+    output.open(QBuffer::WriteOnly);
+
+    console.setOutputDevice(&output);
+    console.addCommand({
+      "status",
+      "Random description...",
+      [&calls](const QConsole::Context& ctx) {
+          calls.append(ctx.arguments.join(" "));
+          return ctx.arguments.value(0).toInt();
+      },
+    });
+    console.addCommand({
+      "echo",
+      "Random description...",
+      [](const QConsole::Context& ctx) {
+          QVERIFY(ctx.output != nullptr);
+          ctx.output->write(ctx.arguments.join(" ").toUtf8().append('\n'));
+      },
+    });
+    console.addCommand({
+      "upper",
+      "Random description...",
+      [](const QConsole::Context& ctx) {
+          QVERIFY(ctx.input != nullptr);
+          ctx.output->write(ctx.input->readAll().toUpper());
+      },
+    });
+    console.addCommand({
+      "check",
+      "Random description...",
+      [](const QConsole::Context& ctx) {
+          if (ctx.input == nullptr || ctx.output != nullptr) {
+              return 2;
+          }
+
+          return ctx.input->readAll() == ctx.arguments.join(" ").toUtf8() + '\n' ? 0 : 1;
+      },
+    });
+
+    QCOMPARE(console.evaluate("status 0; status 1"), 1);
+    QCOMPARE(calls, QStringList({ "0", "1" }));
+
+    calls.clear();
+    QCOMPARE(console.evaluate("status 1 && status 2 || status 0 a && status 0 b"), 0);
+    QCOMPARE(calls, QStringList({ "1", "0 a", "0 b" }));
+
+    calls.clear();
+    QCOMPARE(console.evaluate("status 0||status 3;status 4&&status 5"), 4);
+    QCOMPARE(calls, QStringList({ "0", "4" }));
+
+    // Quoted operators are arguments.
+    calls.clear();
+    QCOMPARE(console.evaluate("status 0 '&&' \"|\" \\;"), 0);
+    QCOMPARE(calls, QStringList({ "0 && | ;" }));
+
+    // More arguments than the command line usually has.
+    QStringList many({ "0" });
+
+    for (int i = 1; i < 40; ++i) {
+        many.append(QString::number(i));
+    }
+
+    calls.clear();
+    QCOMPARE(console.evaluate("status " + many.join(" ") + " && status 0"), 0);
+    QCOMPARE(calls, QStringList({ many.join(" "), "0" }));
+
+    QCOMPARE(console.evaluate("echo Hello world | upper | check HELLO WORLD"), 0);
+    QCOMPARE(console.evaluate("echo Hello | check Hello && echo x | check y"), 1);
+
+    QCOMPARE(console.evaluate("unknown || status 0"), 0);
+    QCOMPARE(console.evaluate("unknown"), 127);
+    QCOMPARE(console.evaluate("status 0 && && status 0"), 2);
+    QCOMPARE(console.evaluate("| status 0"), 2);
+    QCOMPARE(console.evaluate("status 0 |"), 2);
+    QCOMPARE(console.evaluate("status 0;"), 0);
+}
+
+void QConsoleTester::captureTest()
+{
+    QConsole console;
+
+    QBuffer output;
+    output.open(QBuffer::WriteOnly);
+
+    console.setOutputDevice(&output);
+    console.addCommand({
+      "echo",
+      "Random description...",
+      [](const QConsole::Context& ctx) { ctx.ostream() << ctx.arguments.join(" ") << Qt::endl; },
+    });
+    console.addCommand({
+      "nested",
+      "Random description...",
+      [&console](const QConsole::Context& ctx) {
+          QByteArray inner;
+          console.invokeCommandByName("echo", { "inner" }, inner);
+          ctx.ostream() << "outer " << inner;
+      },
+    });
+
+    QByteArray captured("> ");
+
+    QCOMPARE(console.invokeCommandByName("echo", { "Hello", "world" }, captured), 0);
+    QCOMPARE(captured, QByteArray("> Hello world\n"));
+
+    captured.clear();
+    QCOMPARE(console.invokeCommandByName("nested", {}, captured), 0);
+    QCOMPARE(captured, QByteArray("outer inner\n"));
+
+    QCOMPARE(console.invokeCommandByName("unknown", {}, captured), 127);
+
+    // Nothing was written to the console output but the error.
+    QVERIFY(!output.data().contains("Hello"));
+    QVERIFY(output.data().contains("Command not found"));
+
+    QVERIFY(console.evaluate("echo console") == 0);
+    QVERIFY(output.data().contains("console"));
+}
+
+void QConsoleTester::outputTest()
+{
+    QConsole console;
+
+    QBuffer output;
+    output.open(QBuffer::WriteOnly);
+
+    console.setOutputDevice(&output);
+    console.setOutputBuffering(QConsole::Buffering::Manual, 0);
+
+    console.ostream() << "text " << 1 << Qt::endl;
+    console.utf8Stream() << "bytes " << 2 << ' ' << QStringLiteral("héllo") << '\n';
+
+    // Nothing is written until the output is flushed, then it's written at once and in order.
+    QVERIFY(output.data().isEmpty());
+    QCOMPARE(console.outputStatistics().syscalls, quint64(0));
+
+    console.flushOutput();
+    QCOMPARE(output.data(), QByteArray("text 1\nbytes 2 h\xc3\xa9llo\n"));
+    QCOMPARE(console.outputStatistics().bytes, quint64(output.size()));
+    QCOMPARE(console.outputStatistics().syscalls, quint64(1));
+
+    console.setOutputBuffering(QConsole::Buffering::Line);
+    console.utf8Stream() << "partial";
+    QVERIFY(!output.data().endsWith("partial"));
+    console.utf8Stream() << " line\n";
+    QVERIFY(output.data().endsWith("partial line\n"));
+
+    console.setOutputBuffering(QConsole::Buffering::Block, 10);
+    console.utf8Stream() << "late\n";
+    QVERIFY(!output.data().endsWith("late\n"));
+    QTRY_VERIFY(output.data().endsWith("late\n"));
+}
+
+void QConsoleTester::styledTest()
+{
+    QConsole console;
+
+    QBuffer output;
+    output.open(QBuffer::WriteOnly);
+
+    console.setOutputDevice(&output);
+    console.utf8Stream().styled("a", QConsole::Color::Cyan) << ' ';
+    console.utf8Stream().styled("b", QConsole::Paint::palette(208, QConsole::Style::Normal)) << ' ';
+    console.utf8Stream().styled("c", QConsole::Paint::rgb(255, 128, 0)) << '\n';
+
+    QCOMPARE(output.data(), QByteArray("\33[1;36ma\33[0m \33[0;38;5;208mb\33[0m \33[1;38;2;255;128;0mc\33[0m\n"));
+
+    output.buffer().clear();
+    output.seek(0);
+
+    // No escape sequence is written once colors are disabled.
+    console.setNoColor(true);
+    console.utf8Stream().styled("a", QConsole::Color::Cyan) << '\n';
+    QCOMPARE(output.data(), QByteArray("a\n"));
+}
+
+void QConsoleTester::pageTest()
+{
+    QConsole console;
+
+    QBuffer output;
+    output.open(QBuffer::WriteOnly);
+
+    console.setOutputDevice(&output);
+    console.setPagerEnabled(true);
+    console.addCommand({
+      "lines",
+      "Random description...",
+      [&console](const QConsole::Context& ctx) {
+          int count = 0;
+
+          console.page(ctx, [&count](std::string& line) {
+              if (count == 1000) {
+                  return false;
+              }
+
+              line.append("line ").append(std::to_string(count++));
+              return true;
+          });
+      },
+    });
+
+    // The pager isn't shown when the output isn't the terminal, every line is written instead.
+    QCOMPARE(console.evaluate("lines"), 0);
+    QCOMPARE(output.data().count('\n'), 1000);
+    QVERIFY(output.data().startsWith("line 0\nline 1\n"));
+    QVERIFY(output.data().endsWith("line 999\n"));
+
+    QByteArray captured;
+    QCOMPARE(console.invokeCommandByName("lines", {}, captured), 0);
+    QCOMPARE(captured.count('\n'), 1000);
+}
+
+void QConsoleTester::metricsTest()
+{
+    QConsole console;
+
+    QBuffer output;
+    output.open(QBuffer::WriteOnly);
+
+    console.setOutputDevice(&output);
+    console.addDefaultCommands();
+    console.addCommand({
+      "succeed",
+      "Random description...",
+      [](const QConsole::Context& ctx) { Q_UNUSED(ctx) },
+    });
+    console.addCommand({
+      "fail",
+      "Random description...",
+      [](const QConsole::Context& ctx) {
+          Q_UNUSED(ctx)
+          return 1;
+      },
+    });
+
+    QCOMPARE(console.evaluate("succeed; succeed; fail || succeed"), 0);
+    QVERIFY(console.invokeCommandByName("fail"));
+
+    const auto metrics = console.metrics();
+
+    QCOMPARE(metrics.size(), 2);
+    QCOMPARE(metrics[0].name, QString("succeed"));
+    QCOMPARE(metrics[0].invocations, quint64(3));
+    QCOMPARE(metrics[0].errors, quint64(0));
+    QCOMPARE(metrics[1].name, QString("fail"));
+    QCOMPARE(metrics[1].errors, quint64(2));
+    QVERIFY(metrics[0].min <= metrics[0].p50 && metrics[0].p50 <= metrics[0].p99 && metrics[0].p99 <= metrics[0].max);
+
+    const auto document = QJsonDocument::fromJson(console.metricsJson()).object();
+    QCOMPARE(document["commands"].toArray().size(), 2);
+    QCOMPARE(document["commands"].toArray()[0].toObject()["name"].toString(), QString("succeed"));
+
+    QCOMPARE(console.evaluate("stats --reset"), 0);
+    QVERIFY(output.data().contains("succeed"));
+    QVERIFY(output.data().contains("p99"));
+
+    // The invocation of "stats" is recorded after the reset.
+    QCOMPARE(console.metrics().size(), 1);
+
+    console.resetMetrics();
+    QVERIFY(console.metrics().isEmpty());
+    QCOMPARE(console.evaluate("stats --unknown"), 1);
+
+    // The columns line up whatever the characters of the names, the rows have as many
+    // characters as the header.
+    console.addCommand({
+      "🚀-launch",
+      "Random description...",
+      [](const QConsole::Context& ctx) { Q_UNUSED(ctx) },
+    });
+
+    QCOMPARE(console.evaluate("🚀-launch"), 0);
+    output.buffer().clear();
+    output.seek(0);
+    QCOMPARE(console.evaluate("stats"), 0);
+
+    const auto lines = QString::fromUtf8(output.data()).split('\n', Qt::SkipEmptyParts);
+
+    QCOMPARE(lines.size(), 3);
+
+    for (const auto& line : lines) {
+        QCOMPARE(line.toUcs4().size(), lines[0].toUcs4().size());
+    }
+}
+
+void QConsoleTester::traceTest()
+{
+    QConsole console;
+
+    QBuffer output;
+    output.open(QBuffer::WriteOnly);
+
+    console.setOutputDevice(&output);
+    console.addDefaultCommands();
+    console.addCommand({
+      "work",
+      "Random description...",
+      [](const QConsole::Context& ctx) { Q_UNUSED(ctx) },
+    });
+
+    const auto spans = [&console](const QString& name) {
+        QList<QJsonObject> found;
+
+        for (const auto event : QJsonDocument::fromJson(console.traceJson()).object()["traceEvents"].toArray()) {
+            if (const auto object = event.toObject(); object["ph"].toString() == "X" && object["name"].toString() == name) {
+                found.append(object);
+            }
+        }
+
+        return found;
+    };
+
+    // Nothing is recorded until tracing is enabled.
+    QCOMPARE(console.evaluate("work"), 0);
+    QVERIFY(spans("invoke").isEmpty());
+
+    QCOMPARE(console.evaluate("trace on; work; work"), 0);
+
+    const auto invocations = spans("invoke");
+    QCOMPARE(invocations.size(), 2);
+    QCOMPARE(invocations[0]["args"].toObject()["detail"].toString(), QString("work"));
+    QVERIFY(invocations[0]["dur"].toDouble() >= 0);
+
+    console.clearTrace();
+    QVERIFY(spans("invoke").isEmpty());
+
+    console.setTracingEnabled(false);
+    QCOMPARE(console.evaluate("work"), 0);
+    QVERIFY(spans("invoke").isEmpty());
+}
+
+void QConsoleTester::remoteTest()
+{
+    QConsole console;
+    console.setNoColor(true);
+    console.setDefaultPrompt("remote> ");
+    console.addDefaultCommands();
+    console.addCommand({
+      "greet",
+      "Greet someone and change the prompt.",
+      [&console](const QConsole::Context& ctx) {
+          ctx.ostream() << "Hello " << ctx.arguments.value(0) << Qt::endl;
+          console.setPrompt("greeted> ");
+      },
+    });
+    console.addCommand({
+      "ask",
+      "Ask a name.",
+      [&console](const QConsole::Context& ctx) {
+          const auto name = console.readLine("Name? ");
+          ctx.ostream() << "Hi " << name << Qt::endl;
+      },
+    });
+
+    const auto name = QStringLiteral("qconsole-test-%1").arg(QCoreApplication::applicationPid());
+    QVERIFY(console.listen(name));
+
+    QLocalSocket first;
+    QLocalSocket second;
+    QByteArray   firstOutput;
+    QByteArray   secondOutput;
+
+    connect(&first, &QLocalSocket::readyRead, [&]() { firstOutput += first.readAll(); });
+    connect(&second, &QLocalSocket::readyRead, [&]() { secondOutput += second.readAll(); });
+
+    first.connectToServer(name);
+    second.connectToServer(name);
+
+    QTRY_COMPARE(console.sessionCount(), 2);
+    QTRY_VERIFY(firstOutput.contains("remote> "));
+    QTRY_VERIFY(secondOutput.contains("remote> "));
+
+    // The output and the prompt belong to the session.
+    first.write("greet world\r");
+    QTRY_VERIFY(firstOutput.contains("Hello world\r\n"));
+    QTRY_VERIFY(firstOutput.contains("greeted> "));
+    QVERIFY(!secondOutput.contains("Hello"));
+    QVERIFY(console.prompt() == "remote> ");
+
+    // So does the history.
+    firstOutput.clear();
+    first.write("\x1b[A");
+    QTRY_VERIFY(firstOutput.contains("greeted> greet world"));
+
+    // Commands reading a line read it from the session.
+    first.write("\x15ask\r");
+    QTRY_VERIFY(firstOutput.contains("Name? "));
+    first.write("Bob\r");
+    QTRY_VERIFY(firstOutput.contains("Hi Bob\r\n"));
+
+    secondOutput.clear();
+    second.write("gre\t");
+    QTRY_VERIFY(secondOutput.contains("remote> greet "));
+
+    second.write("\x15exit\r");
+    QTRY_COMPARE(second.state(), QLocalSocket::UnconnectedState);
+    QTRY_COMPARE(console.sessionCount(), 1);
+
+    console.stopListening();
+    QTRY_COMPARE(first.state(), QLocalSocket::UnconnectedState);
+    QCOMPARE(console.sessionCount(), 0);
+}
+
+void QConsoleTester::sharedRegistryTest()
+{
+    QConsole                  first;
+    std::unique_ptr<QConsole> session(first.createSession());
+    QConsole&                 second = *session;
+
+    QString check;
+
+    first.addCommand({
+      "ping",
+      "Random description...",
+      [&check](const QConsole::Context& ctx) {
+          Q_UNUSED(ctx)
+          check = "global";
+      },
+    });
+
+    first.addCommand(
+      {
+        "logout",
+        "Random description...",
+        [](const QConsole::Context& ctx) { Q_UNUSED(ctx) },
+      },
+      "online");
+
+    // The commands are shared.
+    QVERIFY(second.invokeCommandByName("ping"));
+    QVERIFY(check == "global");
+    QVERIFY(second.completions("pi") == QList<QString>({ "ping" }));
+
+    // The scopes aren't.
+    second.pushScope("online");
+
+    QVERIFY(second.currentScope() == "online");
+    QVERIFY(second.invokeCommandByName("logout"));
+    QVERIFY(first.currentScope().isEmpty());
+    QVERIFY(!first.invokeCommandByName("logout"));
+
+    // A command removed while it runs finishes with the snapshot it was found in.
+    second.addCommand({
+      "leave",
+      "Random description...",
+      [&first, &check](const QConsole::Context& ctx) {
+          Q_UNUSED(ctx)
+          first.removeCommandByName("leave");
+          check = "left";
+      },
+    });
+
+    QVERIFY(first.invokeCommandByName("leave"));
+    QVERIFY(check == "left");
+    QVERIFY(!second.invokeCommandByName("leave"));
+
+    // Sealing applies to every session, adding a command to a scope unseals it.
+    first.seal();
+    QVERIFY(first.sealed());
+    QVERIFY(second.sealed());
+
+    second.addCommand({
+      "pong",
+      "Random description...",
+      [](const QConsole::Context& ctx) { Q_UNUSED(ctx) },
+    });
+
+    QVERIFY(!first.sealed());
+    QVERIFY(first.invokeCommandByName("pong"));
+    QVERIFY(first.commandCount() == 2);
+    QVERIFY(second.commandCount() == 3);
+}
+
 void QConsoleTester::promptTest()
 {
     QConsole console;
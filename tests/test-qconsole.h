@@ -37,7 +37,31 @@ private:
     Q_SLOT void unicodeTest();
     Q_SLOT void promptTest();
     Q_SLOT void colorizeTest();
+    Q_SLOT void asyncTest();
+    Q_SLOT void printTest();
+    Q_SLOT void argumentsTest();
+    Q_SLOT void sealTest();
+    Q_SLOT void bulkTest();
+    Q_SLOT void scopeTest();
+    Q_SLOT void completionTest();
+    Q_SLOT void hintTest();
+    Q_SLOT void argumentCompletionTest();
+    Q_SLOT void historyTest();
+    Q_SLOT void historySearchTest();
+    Q_SLOT void sharedHistoryTest();
+    Q_SLOT void scriptTest();
+    Q_SLOT void chainTest();
+    Q_SLOT void captureTest();
+    Q_SLOT void outputTest();
+    Q_SLOT void styledTest();
+    Q_SLOT void pageTest();
+    Q_SLOT void metricsTest();
+    Q_SLOT void traceTest();
+    Q_SLOT void remoteTest();
+    Q_SLOT void sharedRegistryTest();
 
     Q_SLOT void populateBenchmark();
+    Q_SLOT void populateBulkBenchmark();
+    Q_SLOT void evaluateBenchmark_data();
     Q_SLOT void evaluateBenchmark();
 };
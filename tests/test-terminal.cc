@@ -0,0 +1,251 @@
+// Copyright (c) 2021 Leonardo da Vinci
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "test-terminal.h"
+#include "pty-harness.h"
+
+#include <QtTest/QtTest>
+
+#include <algorithm>
+#include <vector>
+
+static const QByteArray PROMPT    = "pty> ";
+static const QByteArray KILL_LINE = "\x15";
+static const QByteArray TAB       = "\t";
+static const QByteArray UP        = "\x1b[A";
+static const QByteArray ENTER     = "\r";
+static const QByteArray BACKSPACE = "\x7f";
+
+// The milliseconds after which a keystroke of the benchmark is taken as never redrawn.
+static constexpr int REDRAW_TIMEOUT = 2000;
+
+bool TerminalTester::startConsole(PtyHarness& harness, int commands, const QString& history, int columns)
+{
+    QStringList arguments{ "--commands", QString::number(commands) };
+
+    if (!history.isEmpty()) {
+        arguments << "--history" << history;
+    }
+
+    return harness.start(PTY_CONSOLE, arguments, columns) && harness.waitFor(PROMPT, 10000) >= 0;
+}
+
+void TerminalTester::hintTest()
+{
+    PtyHarness harness;
+    QVERIFY(startConsole(harness));
+
+    // "hello-world" sorts before "help", it's hinted after the typed word.
+    QVERIFY(harness.keystroke("hel", "hello-world") >= 0);
+    QVERIFY(harness.keystroke("p", "help") >= 0);
+    QVERIFY(!harness.screen().contains("hello-world"));
+}
+
+void TerminalTester::highlightTest()
+{
+    PtyHarness harness;
+    QVERIFY(startConsole(harness));
+
+    // The first word is drawn in bright green while it names a command.
+    const auto highlighted = [&harness](const QByteArray& keys, const QByteArray& word) {
+        harness.send(keys);
+        harness.waitForRedraw();
+        return harness.output().contains("32m" + word);
+    };
+
+    QVERIFY(!highlighted("hel", "hel"));
+    QVERIFY(highlighted("p", "help"));
+    QVERIFY(!highlighted("x", "helpx"));
+    QVERIFY(highlighted(BACKSPACE, "help"));
+    QVERIFY(!highlighted(BACKSPACE, "hel"));
+}
+
+void TerminalTester::completionTest()
+{
+    PtyHarness harness;
+    QVERIFY(startConsole(harness));
+
+    QVERIFY(harness.keystroke("hello-w" + TAB, "hello-world") >= 0);
+    QVERIFY(harness.keystroke(KILL_LINE, PROMPT) >= 0);
+
+    // The arguments are completed once the completion callback has finished.
+    QVERIFY(harness.keystroke("connect lo" + TAB, "localhost") >= 0);
+    QVERIFY(harness.keystroke(ENTER, "Connected to localhost") >= 0);
+}
+
+void TerminalTester::historyTest()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    PtyHarness harness;
+    QVERIFY(startConsole(harness, 0, dir.filePath("history")));
+
+    QVERIFY(harness.keystroke("hello-world first" + ENTER, "Arguments: first") >= 0);
+    QVERIFY(harness.keystroke("hello-world second" + ENTER, "Arguments: second") >= 0);
+    QVERIFY(harness.keystroke(UP, "hello-world second") >= 0);
+    QVERIFY(harness.keystroke(UP, "hello-world first") >= 0);
+    QVERIFY(harness.keystroke(ENTER, "Arguments: first") >= 0);
+
+    harness.send("exit" + ENTER);
+    QCOMPARE(harness.stop(), 0);
+
+    // The lines were appended to the history file as they were evaluated.
+    QFile file(dir.filePath("history"));
+    QVERIFY(file.open(QIODevice::ReadOnly));
+
+    const auto lines = file.readAll();
+
+    QVERIFY(lines.contains("hello-world first\n"));
+    QVERIFY(lines.contains("hello-world second\n"));
+}
+
+void TerminalTester::pasteTest()
+{
+    // A pasted line arrives in a single read, the terminal is wide enough to draw it unwrapped.
+    PtyHarness harness;
+    QVERIFY(startConsole(harness, 0, QString(), 1000));
+
+    QByteArray line = "hello-world";
+
+    for (int i = 0; i < 64; ++i) {
+        line += " word" + QByteArray::number(i);
+    }
+
+    QVERIFY(harness.keystroke(line, "word63") >= 0);
+    QVERIFY(harness.keystroke(ENTER, "word62 word63") >= 0);
+}
+
+void TerminalTester::pagerTest()
+{
+    PtyHarness harness;
+    QVERIFY(harness.start(PTY_CONSOLE, { "--pager" }) && harness.waitFor(PROMPT, 10000) >= 0);
+
+    // The screen has 23 rows for the lines and one for the status: an output of 23 lines fits.
+    QVERIFY(harness.keystroke("numbers 23" + ENTER, "produced 23") >= 0);
+    QVERIFY(harness.waitFor(PROMPT) >= 0);
+
+    // The lines are asked for as they're shown.
+    QVERIFY(harness.keystroke("numbers 1000" + ENTER, "lines 1-23") >= 0);
+    QVERIFY(harness.screen().contains("number 23"));
+
+    // A search shows the first matching line at the top.
+    QVERIFY(harness.keystroke("/number 500" + ENTER, "lines 500-522") >= 0);
+    QVERIFY(harness.keystroke("q", "produced 522") >= 0);
+    QVERIFY(harness.waitFor(PROMPT) >= 0);
+}
+
+void TerminalTester::keystrokeBenchmark_data()
+{
+    QTest::addColumn<int>("commands");
+    QTest::addColumn<QByteArray>("scenario");
+
+    QTest::newRow("type-1k") << 1000 << QByteArray("type");
+    QTest::newRow("type-100k") << 100000 << QByteArray("type");
+    QTest::newRow("tab-100k") << 100000 << QByteArray("tab");
+    QTest::newRow("history-10k") << 0 << QByteArray("history");
+    QTest::newRow("paste") << 0 << QByteArray("paste");
+}
+
+void TerminalTester::keystrokeBenchmark()
+{
+    QFETCH(int, commands);
+    QFETCH(QByteArray, scenario);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    const auto history = dir.filePath("history");
+
+    if (scenario == "history") {
+        QFile file(history);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+
+        for (int i = 0; i < 10000; ++i) {
+            file.write("hello-world " + QByteArray::number(i) + '\n');
+        }
+    }
+
+    PtyHarness harness;
+    QVERIFY(startConsole(harness, commands, history));
+
+    std::vector<qint64> samples;
+    size_t              timeouts = 0;
+
+    // A keystroke that isn't redrawn in time is recorded at the timeout, so it weighs on the
+    // percentiles instead of being left out.
+    const auto redraw = [&](const QByteArray& keys) {
+        harness.send(keys);
+
+        const auto latency = harness.waitForRedraw(5, REDRAW_TIMEOUT);
+
+        if (latency < 0) {
+            timeouts++;
+        }
+
+        samples.push_back(latency >= 0 ? latency : qint64(REDRAW_TIMEOUT) * 1000000);
+    };
+
+    for (int round = 0; round < 10; ++round) {
+        if (scenario == "type") {
+            // Every keystroke narrows the hint and the highlighting down.
+            for (const auto key : QByteArray("command-" + QByteArray::number(round * 97))) {
+                redraw(QByteArray(1, key));
+            }
+        } else if (scenario == "tab") {
+            harness.send("command-" + QByteArray::number(1000 + round * 811));
+            harness.waitForRedraw();
+            redraw(TAB);
+        } else if (scenario == "history") {
+            for (int i = 0; i < 10; ++i) {
+                redraw(UP);
+            }
+        } else if (scenario == "paste") {
+            redraw("hello-world " + QByteArray(200, 'x'));
+        }
+
+        harness.send(KILL_LINE);
+        harness.waitForRedraw();
+    }
+
+    QVERIFY(!samples.empty());
+
+    std::sort(samples.begin(), samples.end());
+
+    const auto median = samples[samples.size() / 2];
+    const auto p99    = samples[(samples.size() - 1) * 99 / 100];
+
+    qInfo("%s: %zu keystrokes, %zu timeouts, median %lld us, p99 %lld us", QTest::currentDataTag(), samples.size(),
+          timeouts, median / 1000, p99 / 1000);
+
+    // CI can enforce a latency budget, machines vary too much for a fixed one. A keystroke that
+    // was never redrawn fails it whatever the percentiles.
+    if (const auto budget = qEnvironmentVariableIntValue("QCONSOLE_KEYSTROKE_BUDGET_US"); budget > 0) {
+        QVERIFY2(timeouts == 0, qPrintable(QStringLiteral("%1 keystrokes not redrawn").arg(timeouts)));
+        QVERIFY2(p99 / 1000 <= budget, qPrintable(QStringLiteral("p99 of %1 us").arg(p99 / 1000)));
+    }
+
+    QTest::setBenchmarkResult(static_cast<qreal>(median), QTest::WalltimeNanoseconds);
+}
+
+QTEST_MAIN(TerminalTester);
@@ -0,0 +1,52 @@
+// Copyright (c) 2021 Leonardo da Vinci
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <QtCore/QObject>
+
+class PtyHarness;
+
+// TerminalTester drives the console the way a user does, through a pseudo-terminal, to test
+// the input path and measure how long a keystroke takes to be redrawn.
+class TerminalTester : public QObject
+{
+    Q_OBJECT
+
+public:
+    TerminalTester() = default;
+
+private:
+    Q_SLOT void hintTest();
+    Q_SLOT void highlightTest();
+    Q_SLOT void completionTest();
+    Q_SLOT void historyTest();
+    Q_SLOT void pasteTest();
+    Q_SLOT void pagerTest();
+
+    Q_SLOT void keystrokeBenchmark_data();
+    Q_SLOT void keystrokeBenchmark();
+
+    // Start the console with the generated commands and history, and wait for its prompt.
+    bool startConsole(PtyHarness& harness, int commands = 0, const QString& history = QString(), int columns = 80);
+};